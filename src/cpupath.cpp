@@ -0,0 +1,64 @@
+//
+//  cpupath.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "cpupath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static CPUPath detect_cpu_path() {
+#ifdef CPU_DISPATCH
+    // these also check that the os saves the wider registers.
+    __builtin_cpu_init();
+    // f16c shipped before avx2, both paths count on it for half floats.
+    if (!__builtin_cpu_supports("f16c")) {
+        return CPUPathSSE2;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+        return CPUPathAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return CPUPathAVX2;
+    }
+#endif
+    return CPUPathSSE2;
+}
+
+static CPUPath select_cpu_path() {
+    CPUPath best = detect_cpu_path();
+    const char* env = getenv("SDFLAND_CPU_PATH");
+    if (!env || !env[0]) {
+        return best;
+    }
+
+    for (int i = 0; i < NumCPUPaths; i++) {
+        if (strcmp(env, GetCPUPathName((CPUPath)i)) == 0) {
+            if (i > best) {
+                fprintf(stderr, "SDFLAND_CPU_PATH=%s is not supported by this cpu, using %s\n", env, GetCPUPathName(best));
+                return best;
+            }
+            return (CPUPath)i;
+        }
+    }
+    fprintf(stderr, "unknown SDFLAND_CPU_PATH=%s, using %s\n", env, GetCPUPathName(best));
+    return best;
+}
+
+CPUPath GetCPUPath() {
+    static CPUPath path = select_cpu_path();
+    return path;
+}
+
+const char* GetCPUPathName(CPUPath path) {
+    switch (path) {
+    case CPUPathSSE2: return "sse2";
+    case CPUPathAVX2: return "avx2";
+    case CPUPathAVX512: return "avx512";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,46 @@
+//
+//  cpupath.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_CPUPath_h
+#define hifi_CPUPath_h
+
+// Hot loops are compiled once per instruction set and the variant to run is picked
+// at startup.  A kernel body is written once as a CPU_FORCE_INLINE function, then
+// wrapped by one plain function per path, each marked with the matching CPU_TARGET_*
+// attribute so the compiler vectorizes the inlined body for that instruction set.
+//
+// The SDFLAND_CPU_PATH environment variable forces a path: "sse2", "avx2" or "avx512".
+// A forced path the cpu can't run falls back to the best one it can.
+
+enum CPUPath {
+    CPUPathSSE2 = 0,  // baseline, also used on cpus other than x86
+    CPUPathAVX2,
+    CPUPathAVX512,
+    NumCPUPaths
+};
+
+// detected on first call, same answer afterwards.
+CPUPath GetCPUPath();
+const char* GetCPUPathName(CPUPath path);
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_DISPATCH 1
+#define CPU_FORCE_INLINE inline __attribute__((always_inline))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,f16c")))
+#elif defined(_MSC_VER)
+// msvc has no per function targets, every path runs the same code.
+#define CPU_FORCE_INLINE __forceinline
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#else
+#define CPU_FORCE_INLINE inline
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+#endif
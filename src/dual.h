@@ -0,0 +1,61 @@
+//
+//  dual.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_Dual_h
+#define hifi_Dual_h
+
+#include <math.h>
+
+// Forward-mode dual number, carries a value along with its partial derivatives
+// with respect to a 2d point.  Evaluating an sdf with Dual2 coordinates yields
+// the distance and its exact gradient in a single pass.
+struct Dual2 {
+    Dual2() : v(0.0f) { d[0] = 0.0f; d[1] = 0.0f; }
+    Dual2(float value) : v(value) { d[0] = 0.0f; d[1] = 0.0f; }
+    Dual2(float value, float dx, float dy) : v(value) { d[0] = dx; d[1] = dy; }
+
+    float v;
+    float d[2];
+};
+
+inline Dual2 operator+(const Dual2& a, const Dual2& b) { return Dual2(a.v + b.v, a.d[0] + b.d[0], a.d[1] + b.d[1]); }
+inline Dual2 operator-(const Dual2& a, const Dual2& b) { return Dual2(a.v - b.v, a.d[0] - b.d[0], a.d[1] - b.d[1]); }
+inline Dual2 operator-(const Dual2& a) { return Dual2(-a.v, -a.d[0], -a.d[1]); }
+
+// (ab)' = a'b + ab'
+inline Dual2 operator*(const Dual2& a, const Dual2& b) {
+    return Dual2(a.v * b.v, a.d[0] * b.v + a.v * b.d[0], a.d[1] * b.v + a.v * b.d[1]);
+}
+
+// (a/b)' = (a'b - ab') / b^2
+inline Dual2 operator/(const Dual2& a, const Dual2& b) {
+    float inv_b2 = 1.0f / (b.v * b.v);
+    return Dual2(a.v / b.v, (a.d[0] * b.v - a.v * b.d[0]) * inv_b2, (a.d[1] * b.v - a.v * b.d[1]) * inv_b2);
+}
+
+// comparisons only look at the value.
+inline bool operator<(const Dual2& a, const Dual2& b) { return a.v < b.v; }
+inline bool operator>(const Dual2& a, const Dual2& b) { return a.v > b.v; }
+inline bool operator<=(const Dual2& a, const Dual2& b) { return a.v <= b.v; }
+inline bool operator>=(const Dual2& a, const Dual2& b) { return a.v >= b.v; }
+
+inline float value_of(float a) { return a; }
+inline float value_of(const Dual2& a) { return a.v; }
+
+inline Dual2 fabs(const Dual2& a) { return a.v < 0.0f ? -a : a; }
+
+// the derivative of sqrt is unbounded at zero, use zero there instead.
+inline Dual2 sqrt(const Dual2& a) {
+    float s = sqrtf(a.v);
+    float k = s > 0.0f ? 0.5f / s : 0.0f;
+    return Dual2(s, a.d[0] * k, a.d[1] * k);
+}
+
+inline Dual2 min(const Dual2& a, const Dual2& b) { return b.v < a.v ? b : a; }
+inline Dual2 max(const Dual2& a, const Dual2& b) { return a.v < b.v ? b : a; }
+
+#endif
@@ -0,0 +1,63 @@
+//
+//  half.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "half.h"
+#include "cpupath.h"
+
+#ifdef CPU_DISPATCH
+#include <immintrin.h>
+#endif
+
+typedef void (*FloatToHalfFunc)(const float* src, uint16_t* dst, int n);
+typedef void (*HalfToFloatFunc)(const uint16_t* src, float* dst, int n);
+
+static void float_to_half_scalar(const float* src, uint16_t* dst, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+static void half_to_float_scalar(const uint16_t* src, float* dst, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+
+#ifdef CPU_DISPATCH
+// the avx2 and avx512 paths are only picked on cpus with f16c.
+CPU_TARGET_AVX2 static void float_to_half_f16c(const float* src, uint16_t* dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    float_to_half_scalar(src + i, dst + i, n - i);
+}
+
+CPU_TARGET_AVX2 static void half_to_float_f16c(const uint16_t* src, float* dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+    }
+    half_to_float_scalar(src + i, dst + i, n - i);
+}
+
+static const FloatToHalfFunc FLOAT_TO_HALF_FUNCS[NumCPUPaths] = { float_to_half_scalar, float_to_half_f16c, float_to_half_f16c };
+static const HalfToFloatFunc HALF_TO_FLOAT_FUNCS[NumCPUPaths] = { half_to_float_scalar, half_to_float_f16c, half_to_float_f16c };
+#else
+static const FloatToHalfFunc FLOAT_TO_HALF_FUNCS[NumCPUPaths] = { float_to_half_scalar, float_to_half_scalar, float_to_half_scalar };
+static const HalfToFloatFunc HALF_TO_FLOAT_FUNCS[NumCPUPaths] = { half_to_float_scalar, half_to_float_scalar, half_to_float_scalar };
+#endif
+
+void float_to_half_row(const float* src, uint16_t* dst, int n) {
+    FLOAT_TO_HALF_FUNCS[GetCPUPath()](src, dst, n);
+}
+
+void half_to_float_row(const uint16_t* src, float* dst, int n) {
+    HALF_TO_FLOAT_FUNCS[GetCPUPath()](src, dst, n);
+}
@@ -0,0 +1,82 @@
+//
+//  half.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_Half_h
+#define hifi_Half_h
+
+#include <stdint.h>
+#include <string.h>
+
+// IEEE 754 binary16, 1 sign, 5 exponent and 10 mantissa bits.  Distances within
+// MAX_DISTANCE keep at least 11 significant bits, well under a texel of error.
+
+// round to nearest even, same as the F16C instructions.
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs_x = x & 0x7fffffff;
+
+    if (abs_x >= 0x7f800000) {
+        // inf or nan
+        return (uint16_t)(sign | (abs_x > 0x7f800000 ? 0x7e00 : 0x7c00));
+    }
+    if (abs_x >= 0x477ff000) {
+        // 65520 and up round to inf
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (abs_x < 0x38800000) {
+        // below the smallest normal half, 2^-14
+        if (abs_x < 0x33000000) {
+            return (uint16_t)sign;
+        }
+        uint32_t e = abs_x >> 23;
+        uint32_t m = (abs_x & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - e;
+        uint32_t h = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            h++;
+        }
+        return (uint16_t)(sign | h);
+    }
+
+    // rebias the exponent from 127 to 15, a carry out of the mantissa bumps the exponent.
+    uint32_t h = (abs_x - 0x38000000) >> 13;
+    uint32_t rem = abs_x & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return (uint16_t)(sign | h);
+}
+
+inline float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1f;
+    uint32_t m = h & 0x3ff;
+    uint32_t x;
+    if (e == 0) {
+        // zero or denormal, m * 2^-24 is exact in a float
+        float f = (float)m * (1.0f / 16777216.0f);
+        memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    } else if (e == 31) {
+        x = sign | 0x7f800000 | (m << 13);
+    } else {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// convert n values, uses F16C when the cpu path has it, see cpupath.h.
+void float_to_half_row(const float* src, uint16_t* dst, int n);
+void half_to_float_row(const uint16_t* src, float* dst, int n);
+
+#endif
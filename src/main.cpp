@@ -3,7 +3,6 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 
-#include <stdlib.h> //rand()
 #include <glm/glm.hpp>
 
 #include "render/render.h"
@@ -11,10 +10,14 @@
 #include "render/texture.h"
 #include "render/program.h"
 #include "sdfscene.h"
+#include "sdfstroke.h"
+#include "sdfeditworker.h"
+#include "sdfhistory.h"
+#include "sdfjournal.h"
+#include "sdfprototype.h"
 
 
 static bool quitting = false;
-static float r = 0.0f;
 static SDL_Window *window = NULL;
 static SDL_GLContext gl_context;
 static SDL_Renderer *renderer = NULL;
@@ -27,11 +30,39 @@ static int colorLoc = -1;
 static int modelViewProjMatLoc = -1;
 static int uvMatLoc = -1;
 static int sdfTextureLoc = -1;
+static int idTextureLoc = -1;
+static int sdfDecodeLoc = -1;
 static int positionLoc = -1;
 static int uvLoc = -1;
 static Texture* texture = NULL;
+static Texture* idTexture = NULL;
+
+// only the sign and the neighborhood of the edge are shaded, so 8 bits over a narrow
+// band are enough and a quarter of the float upload.  Use HalfFormat to see the far
+// field with STRIPES.
+static const SDFEditWorker::Format SDF_FORMAT = SDFEditWorker::Unorm8Format;
+static const float SDF_BAND = 0.25f;
+static const bool SDF_DITHER = true;
+
+// time per frame for copying finished tiles to the front buffers, a large edit shows up
+// over a few frames instead of stalling one.
+static const float SYNC_BUDGET_MS = 4.0f;
+
+// while the worker has something in flight the loop checks back this often, it can't
+// wake the loop itself.  Otherwise the loop sleeps until an event, waking now and then
+// anyway.  Frames are paced by vsync, or by FRAME_MS when it isn't available.
+static const Uint32 BUSY_WAIT_MS = 4;
+static const Uint32 IDLE_WAIT_MS = 1000;
+static const Uint32 FRAME_MS = 16;
+
+// edits survive a restart, they are replayed from here on startup.
+static const char* JOURNAL_FILENAME = "sdfland.journal";
 
 static SDFScene* scene = NULL;
+static SDFJournal* journal = NULL;
+static SDFHistory* history = NULL;
+static SDFEditWorker* editWorker = NULL;
+static SDFStroke* stroke = NULL;
 
 static float zoom = 1.0f;
 static glm::vec3 pan;
@@ -45,11 +76,59 @@ void PrintMatrix(const char* name, const glm::mat3& m) {
     SDL_Log("| %10.3f, %10.3f, %10.3f |\n", m[0].z, m[1].z, m[2].z);
 }
 
+// flush what is left of the current stroke and close its undo step.
+void EndStroke() {
+    if (!stroke) {
+        return;
+    }
+    SDFEdit edit;
+    if (stroke->Flush(edit)) {
+        editWorker->Post(edit);
+    }
+    editWorker->EndStep();
+    delete stroke;
+    stroke = NULL;
+}
+
+// upload the part of the scene modified since the last upload, false if there was none.
+bool UploadDirtyRect() {
+    SDFRect rect = editWorker->GetDirtyRect();
+    if (rect.IsEmpty()) {
+        return false;
+    }
+
+    int size = editWorker->GetSize();
+    int offset = rect.y0 * size + rect.x0;
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+
+    texture->Apply(0);
+    switch (editWorker->GetFormat()) {
+    default:
+    case SDFEditWorker::FloatFormat:
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RED, GL_FLOAT, editWorker->GetBuffer() + offset);
+        break;
+    case SDFEditWorker::HalfFormat:
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RED, GL_HALF_FLOAT, editWorker->GetHalfBuffer() + offset);
+        break;
+    case SDFEditWorker::Unorm16Format:
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RED, GL_UNSIGNED_SHORT, editWorker->GetUnorm16Buffer() + offset);
+        break;
+    case SDFEditWorker::Unorm8Format:
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RED, GL_UNSIGNED_BYTE, editWorker->GetUnorm8Buffer() + offset);
+        break;
+    }
+    idTexture->Apply(0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RED, GL_UNSIGNED_SHORT, editWorker->GetIdBuffer() + offset);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    editWorker->ClearDirtyRect();
+    return true;
+}
+
 void render() {
     SDL_GL_MakeCurrent(window, gl_context);
-    r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
 
-    glClearColor(r, 0.0f, 0.0f, 1.0f);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -76,6 +155,15 @@ void render() {
     glUniform1i(sdfTextureLoc, unit);
     texture->Apply(unit);
 
+    // uniform sampler2D idTexture;
+    unit = program->GetTextureUnit(idTextureLoc);
+    glUniform1i(idTextureLoc, unit);
+    idTexture->Apply(unit);
+
+    // uniform vec2 sdfDecode;
+    glm::vec2 sdfDecode = editWorker->GetDecodeScaleBias();
+    glUniform2f(sdfDecodeLoc, sdfDecode.x, sdfDecode.y);
+
     // attribute vec3 position;
     const size_t NUM_POSITIONS = 4;
     Vector3f positions[NUM_POSITIONS] = { Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(1.0, 1.0f, 0.0f), Vector3f(-1.0f, 1.0f, 0.0f) };
@@ -116,6 +204,12 @@ int main(int argc, char *argv[]) {
 
     gl_context = SDL_GL_CreateContext(window);
 
+    // swaps wait for vsync, which paces redraws
+    bool vsync = SDL_GL_SetSwapInterval(1) == 0;
+    if (!vsync) {
+        SDL_Log("vsync unavailable, frames are paced with SDL_Delay: %s\n", SDL_GetError());
+    }
+
 	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 	if (!renderer) {
         SDL_Log("Failed to SDL Renderer: %s", SDL_GetError());
@@ -166,6 +260,18 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
+    idTextureLoc = program->GetUniformLocation("idTexture");
+    if (idTextureLoc < 0) {
+        SDL_Log("Error finding idTextureLoc uniform\n");
+        exit(-1);
+    }
+
+    sdfDecodeLoc = program->GetUniformLocation("sdfDecode");
+    if (sdfDecodeLoc < 0) {
+        SDL_Log("Error finding sdfDecodeLoc uniform\n");
+        exit(-1);
+    }
+
     positionLoc = program->GetAttribLocation("position");
     if (positionLoc < 0) {
         SDL_Log("Error finding position attribute\n");
@@ -178,23 +284,106 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    scene = new SDFScene();
+    // a coarse bake is up in a few milliseconds, the worker refines it in the background
+    scene = new SDFScene(SDFScene::ProgressiveFlag);
+
+    journal = new SDFJournal();
+    if (journal->Open(JOURNAL_FILENAME)) {
+        Uint32 replayStart = SDL_GetTicks();
+        if (journal->Replay(*scene)) {
+            SDL_Log("replayed %d edits from %s in %d ms\n", (int)journal->GetEntries().size(), JOURNAL_FILENAME, (int)(SDL_GetTicks() - replayStart));
+        }
+        scene->SetJournal(journal);
+    } else {
+        SDL_Log("Error opening %s, edits will not be saved\n", JOURNAL_FILENAME);
+    }
+
+    // each stroke is one undo step
+    history = new SDFHistory();
+    scene->SetHistory(history);
 
+    // a dot follows the cursor on a layer of its own, moving it never re-evaluates
+    // the painted scene
+    int cursorLayer = scene->AddLayer(SDFScene::UnionLayer);
+    uint16_t cursorId = scene->AllocId();
+
+    // from here on the scene is only edited on the worker thread
+    editWorker = new SDFEditWorker(scene, SDF_FORMAT, SDF_BAND, SDF_DITHER);
+
+    // both textures are filled by the first UploadDirtyRect(), the front buffers start out all dirty.
     texture = new Texture();
     texture->SetMinFilter(GL_LINEAR);
     texture->SetMagFilter(GL_LINEAR);
     texture->SetSWrap(GL_CLAMP_TO_EDGE);
     texture->SetTWrap(GL_CLAMP_TO_EDGE);
     texture->Create(scene->GetSize(), scene->GetSize());
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_FLOAT, scene->GetBuffer());
+    switch (editWorker->GetFormat()) {
+    default:
+    case SDFEditWorker::FloatFormat:
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_FLOAT, NULL);
+        break;
+    case SDFEditWorker::HalfFormat:
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_HALF_FLOAT, NULL);
+        break;
+    case SDFEditWorker::Unorm16Format:
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+        break;
+    case SDFEditWorker::Unorm8Format:
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+        break;
+    }
+
+    // prim ids are stored as normalized 16-bit, use nearest filtering so ids are never blended.
+    idTexture = new Texture();
+    idTexture->SetMinFilter(GL_NEAREST);
+    idTexture->SetMagFilter(GL_NEAREST);
+    idTexture->SetSWrap(GL_CLAMP_TO_EDGE);
+    idTexture->SetTWrap(GL_CLAMP_TO_EDGE);
+    idTexture->Create(scene->GetSize(), scene->GetSize());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+    UploadDirtyRect();
+
+    float scale = ((float)scene->GetSize() / (float)WINDOW_WIDTH) / (float)scene->GetSamplesPerMeter();
+    float worldSize = (float)scene->GetSize() / scene->GetSamplesPerMeter();
+    windowToWorld = glm::mat3(glm::vec3(scale, 0.0f, 0.0f),
+                              glm::vec3(0.0f, scale, 0.0f),
+                              glm::vec3(-worldSize / 2.0f, -worldSize / 2.0f, 1.0f));
+    PrintMatrix("windowToWorld", windowToWorld);
 
     const float MOUSE_SENSITIVITY = 0.005f;
+    const float BRUSH_RADIUS = 0.2f;
+    const float BRUSH_SPACING = 0.25f * BRUSH_RADIUS;
+    const float CURSOR_RADIUS = 0.02f;
     bool grab = false;
+
+    // the tree of the default scene as a prototype, t plants one at the cursor
+    std::vector<SDFEdit> treeEdits;
+    treeEdits.push_back(SDFEdit::MakeBox(SDFEdit::Add, glm::vec2(0.0f, 0.0f), 0.0f, glm::vec2(0.03f, 0.2f)));
+    treeEdits.push_back(SDFEdit::MakeCircle(SDFEdit::Add, glm::vec2(0.0f, 0.2f), 0.11f));
+    treeEdits.push_back(SDFEdit::MakeCircle(SDFEdit::Add, glm::vec2(0.0f, 0.31f), 0.09f));
+    for (size_t i = 0; i < treeEdits.size(); i++) {
+        treeEdits[i].k = 0.0f;
+    }
+    std::shared_ptr<const SDFPrototype> treePrototype = SDFScene::BakePrototype(treeEdits);
+    glm::vec2 cursorPos(0.0f, 0.0f);
+    bool cursorMoved = false;
+
+    // the first frame is drawn right away, after that only when something changes
+    bool redraw = true;
+    Uint32 lastFrame = SDL_GetTicks();
     while (!quitting) {
+        // sleep until there is an event, or briefly while the worker may still publish
+        // something.  Once woken every queued event is handled before the next frame.
+        Uint32 timeout = redraw ? 0 : (editWorker->IsBusy() ? BUSY_WAIT_MS : IDLE_WAIT_MS);
         SDL_Event event;
-        while (SDL_PollEvent(&event) ) {
+        bool haveEvent = SDL_WaitEventTimeout(&event, timeout) != 0;
+        for (; haveEvent; haveEvent = SDL_PollEvent(&event) != 0) {
             if (event.type == SDL_QUIT) {
                 quitting = true;
+            } else if (event.type == SDL_WINDOWEVENT) {
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                    redraw = true;
+                }
             } else if (event.type == SDL_MOUSEWHEEL) {
                 if (event.wheel.y > 0) {
                     // scroll up
@@ -203,45 +392,99 @@ int main(int argc, char *argv[]) {
                     // scroll down
                     zoom *= 0.9f;
                 }
+                redraw = true;
             } else if (event.type == SDL_MOUSEBUTTONDOWN) {
-                grab = true;
                 glm::vec2 mousePos(event.button.x, WINDOW_HEIGHT - event.button.y);
 
                 SDL_Log("mousePos = %.5f, %.5f\n", mousePos.x, mousePos.y);
 
-                float scale = ((float)scene->GetSize() / (float)WINDOW_WIDTH) / (float)scene->GetSamplesPerMeter();
-                float halfSize = (float)scene->GetSize() / 2.0f;
-                float worldSize = (float)scene->GetSize() / scene->GetSamplesPerMeter();
-                windowToWorld = glm::mat3(glm::vec3(scale, 0.0f, 0.0f),
-                                          glm::vec3(0.0f, scale, 0.0f),
-                                          glm::vec3(-worldSize / 2.0f, -worldSize / 2.0f, 1.0f));
-                PrintMatrix("windowToWorld", windowToWorld);
-
-                float radius = 0.2f;
-
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    scene->AddCircle(windowToWorld * glm::vec3(mousePos, 1.0f), radius);
+                // left paints, right erases, middle pans
+                if (event.button.button == SDL_BUTTON_LEFT || event.button.button == SDL_BUTTON_RIGHT) {
+                    bool remove = event.button.button != SDL_BUTTON_LEFT;
+                    EndStroke();
+                    stroke = new SDFStroke(BRUSH_RADIUS, BRUSH_SPACING, remove, remove ? SDFScene::NO_ID : scene->AllocId());
+                    stroke->AddPoint(windowToWorld * glm::vec3(mousePos, 1.0f));
                 } else {
-                    scene->RemCircle(windowToWorld * glm::vec3(mousePos, 1.0f), radius);
+                    grab = true;
                 }
-
-                // re-load texture
-                texture->Apply(0);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->GetSize(), scene->GetSize(), 0, GL_RED, GL_FLOAT, scene->GetBuffer());
-
             } else if (event.type == SDL_MOUSEBUTTONUP) {
-                grab = false;
+                if (event.button.button == SDL_BUTTON_MIDDLE) {
+                    grab = false;
+                } else {
+                    EndStroke();
+                }
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_t && !stroke) {
+                SDFEdit edit = SDFEdit::MakeInstance(SDFEdit::Add, treePrototype, cursorPos, 0.0f);
+                edit.id = scene->AllocId();
+                editWorker->Post(edit);
+                editWorker->EndStep();
+            } else if (event.type == SDL_KEYDOWN && (event.key.keysym.mod & KMOD_CTRL) && !stroke) {
+                // ctrl-z undoes a stroke, ctrl-shift-z or ctrl-y redoes it
+                if (event.key.keysym.sym == SDLK_z && !(event.key.keysym.mod & KMOD_SHIFT)) {
+                    editWorker->Undo();
+                } else if (event.key.keysym.sym == SDLK_z || event.key.keysym.sym == SDLK_y) {
+                    editWorker->Redo();
+                }
             } else if (event.type == SDL_MOUSEMOTION) {
+                // a stroke keeps every point, the cursor only where the mouse ended up
+                glm::vec2 mousePos(event.motion.x, WINDOW_HEIGHT - event.motion.y);
+                glm::vec2 worldPos = windowToWorld * glm::vec3(mousePos, 1.0f);
+                cursorPos = worldPos;
+                cursorMoved = true;
+                if (stroke) {
+                    stroke->AddPoint(worldPos);
+                }
+
                 if (grab) {
                     pan.x -= MOUSE_SENSITIVITY * zoom * event.motion.xrel;
                     pan.y += MOUSE_SENSITIVITY * zoom * event.motion.yrel;
+                    redraw = true;
+                }
+            }
+        }
+
+        if (cursorMoved) {
+            std::vector<SDFEdit> cursor(1, SDFEdit::MakeCircle(SDFEdit::Add, cursorPos, CURSOR_RADIUS));
+            cursor[0].id = cursorId;
+            editWorker->SetLayerPrims(cursorLayer, cursor);
+            cursorMoved = false;
+        }
+
+        // all motion gathered this frame becomes a single edit
+        SDFEdit edit;
+        if (stroke && stroke->Flush(edit)) {
+            editWorker->Post(edit);
+        }
+
+        // pick up whatever the worker has finished, the rest shows next frame.
+        editWorker->Sync(SYNC_BUDGET_MS);
+        if (UploadDirtyRect()) {
+            redraw = true;
+        }
+
+        if (redraw) {
+            if (!vsync) {
+                Uint32 elapsed = SDL_GetTicks() - lastFrame;
+                if (elapsed < FRAME_MS) {
+                    SDL_Delay(FRAME_MS - elapsed);
                 }
             }
+            render();
+            lastFrame = SDL_GetTicks();
+            redraw = false;
         }
+    }
 
-        render();
-        SDL_Delay(2);
+    const EncodingErrorStats& stats = editWorker->GetErrorStats();
+    if (stats.count) {
+        SDL_Log("sdf encoding error within %.3f of an edge: max %.6f, mean %.6f, rms %.6f over %llu texels\n",
+                SDF_BAND, stats.maxError, stats.GetMeanError(), stats.GetRMSError(), (unsigned long long)stats.count);
     }
+    delete editWorker;
+    scene->SetJournal(NULL);
+    delete journal;
+    scene->SetHistory(NULL);
+    delete history;
 
     SDL_DelEventWatch(watch, NULL);
     SDL_GL_DeleteContext(gl_context);
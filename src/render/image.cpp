@@ -1,5 +1,6 @@
 #include "image.h"
 #include <algorithm>
+#include "../cpupath.h"
 
 extern "C" {
 #include "png.h"
@@ -238,7 +239,7 @@ bool Image::Save(const char* filename) const
 
 typedef void (*ConvertFunc)(const unsigned char* src, unsigned char* dst, int width, int height);
 
-static void rgb_lum(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgb_lum(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 3;
     const int kDstPixelSize = 1;
@@ -256,7 +257,7 @@ static void rgb_lum(const unsigned char* src, unsigned char* dst, int width, int
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
-static void rgb_luma(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgb_luma(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 3;
     const int kDstPixelSize = 2;
@@ -275,7 +276,7 @@ static void rgb_luma(const unsigned char* src, unsigned char* dst, int width, in
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
-static void rgba_lum(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgba_lum(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 4;
     const int kDstPixelSize = 1;
@@ -293,7 +294,7 @@ static void rgba_lum(const unsigned char* src, unsigned char* dst, int width, in
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
-static void rgba_luma(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgba_luma(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 4;
     const int kDstPixelSize = 2;
@@ -313,7 +314,7 @@ static void rgba_luma(const unsigned char* src, unsigned char* dst, int width, i
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
-static void rgb_rgba(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgb_rgba(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 3;
     const int kDstPixelSize = 4;
@@ -330,7 +331,7 @@ static void rgb_rgba(const unsigned char* src, unsigned char* dst, int width, in
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
-static void rgba_rgb(const unsigned char* src, unsigned char* dst, int width, int height)
+CPU_FORCE_INLINE static void rgba_rgb(const unsigned char* __restrict src, unsigned char* __restrict dst, int width, int height)
 {
     const int kSrcPixelSize = 4;
     const int kDstPixelSize = 3;
@@ -346,18 +347,54 @@ static void rgba_rgb(const unsigned char* src, unsigned char* dst, int width, in
     ASSERT(s == src + (kSrcPixelSize * (width * height)));
 }
 
+// The conversions above are compiled once per instruction set, see cpupath.h.
+#define CONVERT_FUNC_VARIANTS(suffix, target) \
+    target static void rgb_lum_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgb_lum(src, dst, width, height); } \
+    target static void rgb_luma_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgb_luma(src, dst, width, height); } \
+    target static void rgba_lum_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgba_lum(src, dst, width, height); } \
+    target static void rgba_luma_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgba_luma(src, dst, width, height); } \
+    target static void rgb_rgba_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgb_rgba(src, dst, width, height); } \
+    target static void rgba_rgb_##suffix(const unsigned char* src, unsigned char* dst, int width, int height) { rgba_rgb(src, dst, width, height); }
+
+CONVERT_FUNC_VARIANTS(sse2, )
+CONVERT_FUNC_VARIANTS(avx2, CPU_TARGET_AVX2)
+CONVERT_FUNC_VARIANTS(avx512, CPU_TARGET_AVX512)
+
+// First index is the CPUPath.
 // Row is the format to convert from.
 // Column is the format to convert to.
-// To convert from rgb to luminance use the function s_convertFuncMap[RGB][Luminance]
-ConvertFunc s_convertFuncMap[Texture::NumPixelFormats][Texture::NumPixelFormats] = {
-    /*                 lum       luma       rgb      rgba       bgr      bgra     depth */
-    /* lum   */ {        0,         0,        0,        0,        0,        0,        0 },
-    /* luma  */ {        0,         0,        0,        0,        0,        0,        0 },
-    /* rgb   */ {  rgb_lum,  rgb_luma,        0, rgb_rgba,        0,        0,        0 },
-    /* rgba  */ { rgba_lum, rgba_luma, rgba_rgb,        0,        0,        0,        0 },
-    /* bgr   */ {        0,         0,        0,        0,        0,        0,        0 },
-    /* bgra  */ {        0,         0,        0,        0,        0,        0,        0 },
-    /* depth */ {        0,         0,        0,        0,        0,        0,        0 }
+// To convert from rgb to luminance use the function s_convertFuncMap[GetCPUPath()][RGB][Luminance]
+ConvertFunc s_convertFuncMap[NumCPUPaths][Texture::NumPixelFormats][Texture::NumPixelFormats] = {
+    {
+        /*                      lum            luma             rgb            rgba    bgr   bgra  depth */
+        /* lum   */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* luma  */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* rgb   */ {  rgb_lum_sse2,  rgb_luma_sse2,              0,  rgb_rgba_sse2,     0,     0,     0 },
+        /* rgba  */ { rgba_lum_sse2, rgba_luma_sse2,  rgba_rgb_sse2,              0,     0,     0,     0 },
+        /* bgr   */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* bgra  */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* depth */ {             0,              0,              0,              0,     0,     0,     0 }
+    },
+    {
+        /*                      lum            luma             rgb            rgba    bgr   bgra  depth */
+        /* lum   */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* luma  */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* rgb   */ {  rgb_lum_avx2,  rgb_luma_avx2,              0,  rgb_rgba_avx2,     0,     0,     0 },
+        /* rgba  */ { rgba_lum_avx2, rgba_luma_avx2,  rgba_rgb_avx2,              0,     0,     0,     0 },
+        /* bgr   */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* bgra  */ {             0,              0,              0,              0,     0,     0,     0 },
+        /* depth */ {             0,              0,              0,              0,     0,     0,     0 }
+    },
+    {
+        /*                        lum              luma               rgb              rgba    bgr   bgra  depth */
+        /* lum   */ {               0,                0,                0,                0,     0,     0,     0 },
+        /* luma  */ {               0,                0,                0,                0,     0,     0,     0 },
+        /* rgb   */ {  rgb_lum_avx512,  rgb_luma_avx512,                0,  rgb_rgba_avx512,     0,     0,     0 },
+        /* rgba  */ { rgba_lum_avx512, rgba_luma_avx512,  rgba_rgb_avx512,                0,     0,     0,     0 },
+        /* bgr   */ {               0,                0,                0,                0,     0,     0,     0 },
+        /* bgra  */ {               0,                0,                0,                0,     0,     0,     0 },
+        /* depth */ {               0,                0,                0,                0,     0,     0,     0 }
+    }
 };
 
 bool Image::ConvertPixelFormat(Texture::PixelFormat newPixelFormat)
@@ -365,7 +402,7 @@ bool Image::ConvertPixelFormat(Texture::PixelFormat newPixelFormat)
     if (m_pixelFormat == newPixelFormat)
         return true;
 
-    ConvertFunc convertFunc = s_convertFuncMap[m_pixelFormat][newPixelFormat];
+    ConvertFunc convertFunc = s_convertFuncMap[GetCPUPath()][m_pixelFormat][newPixelFormat];
     if (!convertFunc)
         return false;
 
@@ -411,6 +448,39 @@ void Image::FlipVertical()
     }
 }
 
+typedef void (*PremultiplyFunc)(unsigned char* bytes, int numPixels);
+
+CPU_FORCE_INLINE static void luma_premultiply(unsigned char* bytes, int numPixels)
+{
+    for (unsigned int i = 0; i < numPixels * 2U; i += 2)
+        bytes[i] = (unsigned char)((unsigned int)bytes[i] * (unsigned int)bytes[i+1] / 255);
+}
+
+CPU_FORCE_INLINE static void rgba_premultiply(unsigned char* bytes, int numPixels)
+{
+    for (unsigned int i = 0; i < numPixels * 4U; i += 4)
+    {
+        bytes[i] = (unsigned char)((unsigned int)bytes[i] * (unsigned int)bytes[i+3] / 255);
+        bytes[i+1] = (unsigned char)((unsigned int)bytes[i+1] * (unsigned int)bytes[i+3] / 255);
+        bytes[i+2] = (unsigned char)((unsigned int)bytes[i+2] * (unsigned int)bytes[i+3] / 255);
+    }
+}
+
+#define PREMULTIPLY_FUNC_VARIANTS(suffix, target) \
+    target static void luma_premultiply_##suffix(unsigned char* bytes, int numPixels) { luma_premultiply(bytes, numPixels); } \
+    target static void rgba_premultiply_##suffix(unsigned char* bytes, int numPixels) { rgba_premultiply(bytes, numPixels); }
+
+PREMULTIPLY_FUNC_VARIANTS(sse2, )
+PREMULTIPLY_FUNC_VARIANTS(avx2, CPU_TARGET_AVX2)
+PREMULTIPLY_FUNC_VARIANTS(avx512, CPU_TARGET_AVX512)
+
+// First index is the CPUPath, second is luminance alpha or rgba.
+static PremultiplyFunc s_premultiplyFuncMap[NumCPUPaths][2] = {
+    { luma_premultiply_sse2, rgba_premultiply_sse2 },
+    { luma_premultiply_avx2, rgba_premultiply_avx2 },
+    { luma_premultiply_avx512, rgba_premultiply_avx512 }
+};
+
 void Image::PremultiplyAlpha()
 {
     for (int m = 0; m < m_numMips; ++m)
@@ -420,19 +490,9 @@ void Image::PremultiplyAlpha()
         int height = m_mips[m].height;
 
         if (m_pixelFormat == Texture::LuminanceAlpha)
-        {
-            for (unsigned int i = 0; i < width * height * 2U; i += 2)
-                bytes[i] = (unsigned char)((unsigned int)bytes[i] * (unsigned int)bytes[i+1] / 255);
-        }
+            s_premultiplyFuncMap[GetCPUPath()][0](bytes, width * height);
         else if (m_pixelFormat == Texture::RGBA || m_pixelFormat == Texture::BGRA)
-        {
-            for (unsigned int i = 0; i < width * height * 4U; i += 4)
-            {
-                bytes[i] = (unsigned char)((unsigned int)bytes[i] * (unsigned int)bytes[i+3] / 255);
-                bytes[i+1] = (unsigned char)((unsigned int)bytes[i+1] * (unsigned int)bytes[i+3] / 255);
-                bytes[i+2] = (unsigned char)((unsigned int)bytes[i+2] * (unsigned int)bytes[i+3] / 255);
-            }
-        }
+            s_premultiplyFuncMap[GetCPUPath()][1](bytes, width * height);
     }
 }
 
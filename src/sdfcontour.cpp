@@ -0,0 +1,344 @@
+//
+//  sdfcontour.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfcontour.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <stdio.h>
+
+// grid edges are keyed by the corner texel they start from, horizontal edges run
+// from (x, y) to (x + 1, y) and vertical edges from (x, y) to (x, y + 1).
+static uint32_t horiz_key(int x, int y, int size) {
+    return 2 * (uint32_t)(y * size + x);
+}
+
+static uint32_t vert_key(int x, int y, int size) {
+    return 2 * (uint32_t)(y * size + x) + 1;
+}
+
+// zero crossing along an edge, always interpolated from the lower corner so the
+// two cells sharing an edge produce bit identical points.
+static glm::vec2 edge_point(const float* buffer, int size, uint32_t key) {
+    int texel = (int)(key / 2);
+    int x = texel % size;
+    int y = texel / size;
+    float a = buffer[texel];
+    float b = (key & 1) ? buffer[texel + size] : buffer[texel + 1];
+    float t = a / (a - b);
+    return (key & 1) ? glm::vec2((float)x, (float)y + t) : glm::vec2((float)x + t, (float)y);
+}
+
+static void emit_fan(std::vector<glm::vec2>& fill, const glm::vec2* poly, int count) {
+    for (int i = 1; i < count - 1; i++) {
+        fill.push_back(poly[0]);
+        fill.push_back(poly[i]);
+        fill.push_back(poly[i + 1]);
+    }
+}
+
+static void emit_quad(std::vector<glm::vec2>& fill, float x0, float y0, float x1, float y1) {
+    glm::vec2 quad[4] = {glm::vec2(x0, y0), glm::vec2(x1, y0), glm::vec2(x1, y1), glm::vec2(x0, y1)};
+    emit_fan(fill, quad, 4);
+}
+
+SDFContour::SDFContour(int tileSize) : _tileSize(tileSize), _size(0), _tilesPerRow(0) {
+}
+
+void SDFContour::Extract(const SDFScene& scene) {
+    // a buffer of size n has n - 1 cells per row.
+    _size = scene.GetSize();
+    int numCells = _size - 1;
+    _tilesPerRow = (numCells + _tileSize - 1) / _tileSize;
+    _tiles.resize(_tilesPerRow * _tilesPerRow);
+
+    std::vector<int> tileIndices;
+    for (int ty = 0; ty < _tilesPerRow; ty++) {
+        for (int tx = 0; tx < _tilesPerRow; tx++) {
+            Tile& tile = _tiles[ty * _tilesPerRow + tx];
+            tile.x0 = tx * _tileSize;
+            tile.y0 = ty * _tileSize;
+            tile.x1 = std::min(tile.x0 + _tileSize, numCells);
+            tile.y1 = std::min(tile.y0 + _tileSize, numCells);
+            tileIndices.push_back(ty * _tilesPerRow + tx);
+        }
+    }
+
+    ExtractTiles(scene, tileIndices);
+    Stitch(scene);
+}
+
+void SDFContour::Update(const SDFScene& scene, const SDFRect& rect) {
+    if (_size != scene.GetSize()) {
+        Extract(scene);
+        return;
+    }
+    if (rect.IsEmpty()) {
+        return;
+    }
+
+    // a texel is a corner of the cells to its lower left, so grow the rect by one cell.
+    int cx0 = std::max(rect.x0 - 1, 0) / _tileSize;
+    int cy0 = std::max(rect.y0 - 1, 0) / _tileSize;
+    int cx1 = std::min((rect.x1 - 1) / _tileSize, _tilesPerRow - 1);
+    int cy1 = std::min((rect.y1 - 1) / _tileSize, _tilesPerRow - 1);
+
+    std::vector<int> tileIndices;
+    for (int ty = cy0; ty <= cy1; ty++) {
+        for (int tx = cx0; tx <= cx1; tx++) {
+            tileIndices.push_back(ty * _tilesPerRow + tx);
+        }
+    }
+
+    ExtractTiles(scene, tileIndices);
+    Stitch(scene);
+}
+
+void SDFContour::ExtractTiles(const SDFScene& scene, const std::vector<int>& tileIndices) {
+    const float* buffer = scene.GetBuffer();
+    int size = _size;
+
+    auto extractTile = [buffer, size](Tile& tile) {
+        tile.segments.clear();
+        tile.fill.clear();
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            int runStart = -1;  // run of fully solid cells, merged into a single quad
+            for (int x = tile.x0; x < tile.x1; x++) {
+                // corners and edges in counter-clockwise order, starting at the lower left.
+                glm::vec2 corner[4] = {glm::vec2((float)x, (float)y), glm::vec2((float)(x + 1), (float)y),
+                                       glm::vec2((float)(x + 1), (float)(y + 1)), glm::vec2((float)x, (float)(y + 1))};
+                float d[4] = {buffer[y * size + x], buffer[y * size + x + 1],
+                              buffer[(y + 1) * size + x + 1], buffer[(y + 1) * size + x]};
+                uint32_t edge[4] = {horiz_key(x, y, size), vert_key(x + 1, y, size),
+                                    horiz_key(x, y + 1, size), vert_key(x, y, size)};
+
+                int mask = (d[0] < 0.0f ? 1 : 0) | (d[1] < 0.0f ? 2 : 0) | (d[2] < 0.0f ? 4 : 0) | (d[3] < 0.0f ? 8 : 0);
+                if (mask == 15) {
+                    if (runStart < 0) {
+                        runStart = x;
+                    }
+                    continue;
+                }
+                if (runStart >= 0) {
+                    emit_quad(tile.fill, (float)runStart, (float)y, (float)x, (float)(y + 1));
+                    runStart = -1;
+                }
+                if (mask == 0) {
+                    continue;
+                }
+
+                // crossings, an edge is "exiting" when walking counter-clockwise leaves the solid.
+                int crossings[4];
+                bool exiting[4];
+                int numCrossings = 0;
+                for (int i = 0; i < 4; i++) {
+                    bool in0 = d[i] < 0.0f;
+                    bool in1 = d[(i + 1) % 4] < 0.0f;
+                    if (in0 != in1) {
+                        crossings[numCrossings] = i;
+                        exiting[numCrossings] = in0;
+                        numCrossings++;
+                    }
+                }
+
+                glm::vec2 point[4];
+                for (int i = 0; i < numCrossings; i++) {
+                    point[i] = edge_point(buffer, size, edge[crossings[i]]);
+                }
+
+                // the solid is kept on the left by running each segment from an exiting
+                // crossing to an entering one.  Saddles are resolved by the cell center,
+                // when it is solid each exit pairs with the next entry, otherwise the previous.
+                bool centerSolid = (d[0] + d[1] + d[2] + d[3]) < 0.0f;
+                for (int i = 0; i < numCrossings; i++) {
+                    if (!exiting[i]) {
+                        continue;
+                    }
+                    int j = (numCrossings == 2 || centerSolid) ? (i + 1) % numCrossings : (i + numCrossings - 1) % numCrossings;
+                    Segment seg;
+                    seg.startKey = edge[crossings[i]];
+                    seg.endKey = edge[crossings[j]];
+                    seg.start = point[i];
+                    seg.end = point[j];
+                    tile.segments.push_back(seg);
+                }
+
+                // solid part of the cell
+                if (numCrossings == 4 && !centerSolid) {
+                    // two separate corners, each one triangle
+                    for (int i = 0; i < 4; i++) {
+                        if (d[i] < 0.0f) {
+                            glm::vec2 tri[3] = {point[(i + 3) % 4], corner[i], point[i]};
+                            emit_fan(tile.fill, tri, 3);
+                        }
+                    }
+                } else {
+                    // walk the cell boundary, the solid corners and crossings form a convex polygon
+                    glm::vec2 poly[8];
+                    int count = 0;
+                    int c = 0;
+                    for (int i = 0; i < 4; i++) {
+                        if (d[i] < 0.0f) {
+                            poly[count++] = corner[i];
+                        }
+                        if (c < numCrossings && crossings[c] == i) {
+                            poly[count++] = point[c++];
+                        }
+                    }
+                    emit_fan(tile.fill, poly, count);
+                }
+            }
+            if (runStart >= 0) {
+                emit_quad(tile.fill, (float)runStart, (float)y, (float)tile.x1, (float)(y + 1));
+            }
+        }
+    };
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        int i;
+        while ((i = next++) < (int)tileIndices.size()) {
+            extractTile(_tiles[tileIndices[i]]);
+        }
+    };
+
+    int numThreads = std::min((int)std::thread::hardware_concurrency(), (int)tileIndices.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+void SDFContour::Stitch(const SDFScene& scene) {
+    // gather the segments in tile order, so the output only depends on the buffer
+    // and never on the order the tiles finished in.
+    std::vector<const Segment*> segments;
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        for (size_t j = 0; j < _tiles[i].segments.size(); j++) {
+            segments.push_back(&_tiles[i].segments[j]);
+        }
+    }
+
+    // every edge crossing has at most one segment leaving it and one entering it.
+    std::unordered_map<uint32_t, int> startMap;
+    std::unordered_set<uint32_t> endKeys;
+    startMap.reserve(segments.size());
+    endKeys.reserve(segments.size());
+    for (size_t i = 0; i < segments.size(); i++) {
+        startMap[segments[i]->startKey] = (int)i;
+        endKeys.insert(segments[i]->endKey);
+    }
+
+    _polylines.clear();
+    std::vector<bool> used(segments.size(), false);
+
+    auto follow = [&](int first, bool closed) {
+        Polyline polyline;
+        polyline.closed = closed;
+        polyline.points.push_back(scene.BufferToWorld(segments[first]->start));
+        int i = first;
+        while (i >= 0 && !used[i]) {
+            used[i] = true;
+            std::unordered_map<uint32_t, int>::const_iterator iter = startMap.find(segments[i]->endKey);
+            int next = iter != startMap.end() ? iter->second : -1;
+            // a closed loop ends where it began, don't repeat the first point.
+            if (!(closed && next == first)) {
+                polyline.points.push_back(scene.BufferToWorld(segments[i]->end));
+            }
+            i = next;
+        }
+        _polylines.push_back(polyline);
+    };
+
+    // open contours start at the edge of the buffer, where nothing flows into them.
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (!used[i] && endKeys.find(segments[i]->startKey) == endKeys.end()) {
+            follow((int)i, false);
+        }
+    }
+
+    // everything left is a closed loop
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (!used[i]) {
+            follow((int)i, true);
+        }
+    }
+
+    _worldMin = scene.BufferToWorld(glm::vec2(0.0f, 0.0f));
+    _worldMax = scene.BufferToWorld(glm::vec2((float)(_size - 1), (float)(_size - 1)));
+}
+
+void SDFContour::BuildFillMesh(std::vector<glm::vec2>& vertices, std::vector<uint32_t>& indices) const {
+    // buffer to world is a uniform scale plus offset
+    glm::vec2 origin = _worldMin;
+    float scale = (_worldMax.x - _worldMin.x) / (float)(_size - 1);
+
+    vertices.clear();
+    indices.clear();
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        const std::vector<glm::vec2>& fill = _tiles[i].fill;
+        for (size_t j = 0; j < fill.size(); j++) {
+            indices.push_back((uint32_t)vertices.size());
+            vertices.push_back(origin + fill[j] * scale);
+        }
+    }
+}
+
+bool SDFContour::SaveSVG(const char* filename) const {
+#ifdef _WIN32
+    FILE *fp = NULL;
+    fopen_s(&fp, filename, "w");
+#else
+    FILE *fp = fopen(filename, "w");
+#endif
+    if (!fp) {
+        fprintf(stderr, "Error: Failed to open \"%s\"\n", filename);
+        return false;
+    }
+
+    // svg is y down, flip the world about the x axis.
+    glm::vec2 extent = _worldMax - _worldMin;
+    float strokeWidth = extent.x / (float)_size;
+    fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"%g %g %g %g\">\n",
+            _worldMin.x, -_worldMax.y, extent.x, extent.y);
+
+    // closed loops go in a single path, holes wind the other way so the nonzero rule cuts them out.
+    fprintf(fp, "<path fill=\"gray\" stroke=\"black\" stroke-width=\"%g\" d=\"", strokeWidth);
+    for (size_t i = 0; i < _polylines.size(); i++) {
+        const Polyline& polyline = _polylines[i];
+        if (polyline.closed) {
+            for (size_t j = 0; j < polyline.points.size(); j++) {
+                fprintf(fp, "%c%g %g ", j == 0 ? 'M' : 'L', polyline.points[j].x, -polyline.points[j].y);
+            }
+            fprintf(fp, "Z ");
+        }
+    }
+    fprintf(fp, "\"/>\n");
+
+    for (size_t i = 0; i < _polylines.size(); i++) {
+        const Polyline& polyline = _polylines[i];
+        if (!polyline.closed) {
+            fprintf(fp, "<path fill=\"none\" stroke=\"black\" stroke-width=\"%g\" d=\"", strokeWidth);
+            for (size_t j = 0; j < polyline.points.size(); j++) {
+                fprintf(fp, "%c%g %g ", j == 0 ? 'M' : 'L', polyline.points[j].x, -polyline.points[j].y);
+            }
+            fprintf(fp, "\"/>\n");
+        }
+    }
+    fprintf(fp, "</svg>\n");
+    fclose(fp);
+    return true;
+}
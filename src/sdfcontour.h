@@ -0,0 +1,66 @@
+//
+//  sdfcontour.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFContour_h
+#define hifi_SDFContour_h
+
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sdfscene.h"
+
+// Extracts the zero isocontour of an SDFScene buffer with marching squares.
+// The buffer is split into tiles which are extracted in parallel, then the
+// per-tile segments are stitched into ordered polylines.  Solids are kept on the
+// left of each polyline, so outer boundaries wind counter-clockwise and holes clockwise.
+class SDFContour {
+public:
+    struct Polyline {
+        std::vector<glm::vec2> points;  // world space
+        bool closed;                    // false if the contour runs off the edge of the buffer
+    };
+
+    SDFContour(int tileSize = 64);
+
+    // extract every tile of the scene.
+    void Extract(const SDFScene& scene);
+
+    // re-extract only the tiles touched by rect, usually scene.GetDirtyRect().
+    void Update(const SDFScene& scene, const SDFRect& rect);
+
+    const std::vector<Polyline>& GetPolylines() const { return _polylines; }
+
+    // triangles covering the solid (negative) region, in world space.
+    void BuildFillMesh(std::vector<glm::vec2>& vertices, std::vector<uint32_t>& indices) const;
+
+    bool SaveSVG(const char* filename) const;
+
+protected:
+    struct Segment {
+        uint32_t startKey, endKey;  // grid edges the segment crosses
+        glm::vec2 start, end;       // buffer space
+    };
+
+    struct Tile {
+        int x0, y0, x1, y1;  // cells covered by this tile
+        std::vector<Segment> segments;
+        std::vector<glm::vec2> fill;  // buffer space triangle list
+    };
+
+    void ExtractTiles(const SDFScene& scene, const std::vector<int>& tileIndices);
+    void Stitch(const SDFScene& scene);
+
+    int _tileSize;
+    int _size;
+    int _tilesPerRow;
+    std::vector<Tile> _tiles;
+    std::vector<Polyline> _polylines;
+    glm::vec2 _worldMin, _worldMax;
+};
+
+#endif
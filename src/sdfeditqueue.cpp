@@ -0,0 +1,118 @@
+//
+//  sdfeditqueue.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfeditqueue.h"
+
+#include <stdint.h>
+#include <type_traits>
+
+const uint32_t SDFEditQueue::NO_SHAPE;
+
+// bounded multi-producer queue after Dmitry Vyukov's design.
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+SDFEditQueue::SDFEditQueue(size_t capacity) {
+    static_assert(std::is_trivially_copyable<Record>::value, "slots must only hold plain data");
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    _slots = new Slot[size];
+    _shapes = new Shape[size];
+    _mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    _pushPos.store(0, std::memory_order_relaxed);
+    _popPos.store(0, std::memory_order_relaxed);
+}
+
+SDFEditQueue::~SDFEditQueue() {
+    // TODO: use a unique_ptr
+    delete [] _slots;
+    delete [] _shapes;
+}
+
+bool SDFEditQueue::TryPush(const SDFEdit& edit) {
+    size_t pos = _pushPos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = _slots[pos & _mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // slot is free, claim it.
+            if (_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                Record& record = slot.record;
+                record.op = (uint8_t)edit.op;
+                record.type = (uint8_t)edit.type;
+                record.id = edit.id;
+                record.pos = edit.pos;
+                record.angle = edit.angle;
+                record.r = edit.r;
+                record.k = edit.k;
+                record.shape = NO_SHAPE;
+                if (edit.poly || edit.proto) {
+                    record.shape = (uint32_t)(pos & _mask);
+                    _shapes[record.shape].poly = edit.poly;
+                    _shapes[record.shape].proto = edit.proto;
+                }
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the consumer hasn't freed this slot yet, full.
+            return false;
+        } else {
+            // another producer got here first
+            pos = _pushPos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t SDFEditQueue::PopBatch(SDFEdit* out, size_t maxCount) {
+    // single consumer, so the pop position needs no compare and swap.
+    size_t pos = _popPos.load(std::memory_order_relaxed);
+    size_t count = 0;
+    while (count < maxCount) {
+        Slot& slot = _slots[pos & _mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != pos + 1) {
+            break;
+        }
+        const Record& record = slot.record;
+        SDFEdit& edit = out[count++];
+        edit.op = (SDFEdit::Op)record.op;
+        edit.type = (SDFEdit::Type)record.type;
+        edit.id = record.id;
+        edit.pos = record.pos;
+        edit.angle = record.angle;
+        edit.r = record.r;
+        edit.k = record.k;
+        if (record.shape != NO_SHAPE) {
+            edit.poly = std::move(_shapes[record.shape].poly);
+            edit.proto = std::move(_shapes[record.shape].proto);
+        } else {
+            edit.poly.reset();
+            edit.proto.reset();
+        }
+        slot.seq.store(pos + _mask + 1, std::memory_order_release);
+        pos++;
+    }
+    _popPos.store(pos, std::memory_order_relaxed);
+    return count;
+}
+
+bool SDFEditQueue::IsEmpty() const {
+    size_t pos = _popPos.load(std::memory_order_relaxed);
+    return _slots[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+size_t SDFEditQueue::GetSize() const {
+    size_t push = _pushPos.load(std::memory_order_relaxed);
+    size_t pop = _popPos.load(std::memory_order_relaxed);
+    return push > pop ? push - pop : 0;
+}
@@ -0,0 +1,82 @@
+//
+//  sdfeditqueue.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFEditQueue_h
+#define hifi_SDFEditQueue_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <glm/glm.hpp>
+
+#include "sdfscene.h"
+
+// Bounded lock-free ring buffer of edits with many producers and a single consumer.
+// Each slot carries a sequence number which tells a producer when the slot is free
+// and the consumer when it has been filled, so neither side ever takes a lock.
+//
+// Slots hold a plain copy of the edit's values.  The polygon or prototype of an edit
+// is kept apart, in a table with one entry per slot which the record refers to by
+// handle, so only edits that have one touch a reference count.
+class SDFEditQueue {
+public:
+    // capacity is rounded up to a power of two.
+    SDFEditQueue(size_t capacity);
+    ~SDFEditQueue();
+
+    // any thread, returns false if the queue is full.
+    bool TryPush(const SDFEdit& edit);
+
+    // consumer thread only, copies up to maxCount edits into out in the order they were pushed.
+    size_t PopBatch(SDFEdit* out, size_t maxCount);
+
+    // consumer thread only.
+    bool IsEmpty() const;
+
+    // approximate when called while other threads push or pop.
+    size_t GetSize() const;
+    size_t GetCapacity() const { return _mask + 1; }
+
+protected:
+    static const uint32_t NO_SHAPE = 0xffffffff;
+
+    // SDFEdit without the shared pointers.
+    struct Record {
+        uint8_t op;
+        uint8_t type;
+        uint16_t id;
+        glm::vec2 pos;
+        float angle;
+        glm::vec2 r;
+        float k;
+        uint32_t shape;  // index into _shapes, or NO_SHAPE
+    };
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        Record record;
+    };
+
+    // owned by whoever owns the slot of the same index.
+    struct Shape {
+        std::shared_ptr<const SDFPolygon> poly;
+        std::shared_ptr<const SDFPrototype> proto;
+    };
+
+    Slot* _slots;
+    Shape* _shapes;
+    size_t _mask;
+
+    // keep the producer and consumer positions on separate cache lines.  Padded by hand,
+    // the queue is a member of classes allocated with a plain new.
+    std::atomic<size_t> _pushPos;
+    char _pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _popPos;
+};
+
+#endif
@@ -0,0 +1,378 @@
+//
+//  sdfeditworker.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfeditworker.h"
+#include "half.h"
+#include "sdfhistory.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+static const size_t QUEUE_CAPACITY = 1024;
+
+// edits pulled off the queue at once, covered edits are only dropped within a batch.
+static const size_t MAX_BATCH_SIZE = 64;
+
+// Sync() copies the back buffer to the front in tiles this big, and stops between tiles
+// once its budget is spent.
+static const int SYNC_TILE_SIZE = 64;
+
+SDFEditWorker::SDFEditWorker(SDFScene* scene, Format format, float band, bool dither) : _scene(scene), _format(format), _band(band), _dither(dither), _queue(QUEUE_CAPACITY), _quit(false), _sleeping(false), _syncRequested(false), _baking(false), _numPosted(0), _numApplied(0) {
+    _size = scene->GetSize();
+    _frontBuffer = format == FloatFormat ? new float[_size * _size] : NULL;
+    _frontHalfBuffer = format == HalfFormat ? new uint16_t[_size * _size] : NULL;
+    _frontUnorm16Buffer = format == Unorm16Format ? new uint16_t[_size * _size] : NULL;
+    _frontUnorm8Buffer = format == Unorm8Format ? new uint8_t[_size * _size] : NULL;
+    _decodedRow.resize(_size);
+    _compositeRow.resize(_size);
+    _compositeIdRow.resize(_size);
+    _layerPrims.resize(scene->GetNumLayers());
+    _layerPending.resize(scene->GetNumLayers(), false);
+    _tilesPerRow = (_size + SYNC_TILE_SIZE - 1) / SYNC_TILE_SIZE;
+    _pendingTiles.resize(_tilesPerRow * _tilesPerRow);
+    _numPendingTiles = 0;
+    _nextPendingTile = 0;
+    _frontIdBuffer = new uint16_t[_size * _size];
+    _frontDirtyRect = SDFRect(0, 0, _size, _size);
+    CopyToFront(_frontDirtyRect);
+    scene->ClearDirtyRect();
+    _baking = scene->GetBakeStep() > 1;
+
+    _thread = std::thread(&SDFEditWorker::Run, this);
+}
+
+SDFEditWorker::~SDFEditWorker() {
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _quit = true;
+    }
+    _wakeCond.notify_one();
+    {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _syncRequested = false;
+    }
+    _syncCond.notify_one();
+    _thread.join();
+
+    // TODO: use a unique_ptr
+    delete [] _frontBuffer;
+    delete [] _frontHalfBuffer;
+    delete [] _frontUnorm16Buffer;
+    delete [] _frontUnorm8Buffer;
+    delete [] _frontIdBuffer;
+}
+
+void SDFEditWorker::Post(const SDFEdit& edit) {
+    while (!_queue.TryPush(edit)) {
+        // full, wait for the worker to drain a batch.
+        std::this_thread::yield();
+    }
+    _numPosted++;
+    // order the push before the load, so a worker that missed this edit has
+    // already set _sleeping and is either waiting or about to re-check the queue.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping) {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _wakeCond.notify_one();
+    }
+}
+
+void SDFEditWorker::SetLayerPrims(int layer, const std::vector<SDFEdit>& prims) {
+    _layerPrims[layer] = prims;
+    _layerPending[layer] = true;
+}
+
+bool SDFEditWorker::Sync(float budgetMs) {
+    _syncRequested = true;
+    std::unique_lock<std::mutex> lock(_bufferMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < _layerPending.size(); i++) {
+        if (_layerPending[i]) {
+            _scene->SetLayerPrims((int)i, _layerPrims[i]);
+            _layerPrims[i].clear();
+            _layerPending[i] = false;
+        }
+    }
+
+    SDFRect rect = _scene->GetDirtyRect();
+    if (!rect.IsEmpty()) {
+        MarkPending(rect);
+        _scene->ClearDirtyRect();
+    }
+    CopyPending(budgetMs);
+
+    _syncRequested = false;
+    lock.unlock();
+    _syncCond.notify_one();
+    return true;
+}
+
+bool SDFEditWorker::HasPendingTiles() const {
+    return _numPendingTiles > 0;
+}
+
+bool SDFEditWorker::IsBusy() const {
+    if (_numApplied.load() < _numPosted.load() || _baking || _numPendingTiles > 0) {
+        return true;
+    }
+    return std::find(_layerPending.begin(), _layerPending.end(), true) != _layerPending.end();
+}
+
+void SDFEditWorker::MarkPending(const SDFRect& rect) {
+    for (int ty = rect.y0 / SYNC_TILE_SIZE; ty <= (rect.y1 - 1) / SYNC_TILE_SIZE; ty++) {
+        for (int tx = rect.x0 / SYNC_TILE_SIZE; tx <= (rect.x1 - 1) / SYNC_TILE_SIZE; tx++) {
+            SDFRect tile(tx * SYNC_TILE_SIZE, ty * SYNC_TILE_SIZE, (tx + 1) * SYNC_TILE_SIZE, (ty + 1) * SYNC_TILE_SIZE);
+            SDFRect& pending = _pendingTiles[ty * _tilesPerRow + tx];
+            if (pending.IsEmpty()) {
+                _numPendingTiles++;
+            }
+            pending = pending.Union(rect.Intersect(tile));
+        }
+    }
+}
+
+// copies pending tiles to the front, round robin so tiles that keep getting dirty can't
+// starve the others.  At least one tile goes through however small the budget.
+void SDFEditWorker::CopyPending(float budgetMs) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int numTiles = (int)_pendingTiles.size();
+    for (int i = 0; i < numTiles && _numPendingTiles > 0; i++) {
+        int index = _nextPendingTile;
+        _nextPendingTile = (_nextPendingTile + 1) % numTiles;
+        SDFRect& pending = _pendingTiles[index];
+        if (pending.IsEmpty()) {
+            continue;
+        }
+        CopyToFront(pending);
+        _frontDirtyRect = _frontDirtyRect.Union(pending);
+        pending = SDFRect();
+        _numPendingTiles--;
+        if (budgetMs > 0.0f && std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs) {
+            break;
+        }
+    }
+}
+
+float SDFEditWorker::SampleDistance(const glm::vec2& worldPoint) const {
+    // texel (x, y) holds the distance at buffer point (x, y)
+    glm::vec2 p = _scene->WorldToBuffer(worldPoint);
+    p = glm::clamp(p, glm::vec2(0.0f, 0.0f), glm::vec2((float)(_size - 1), (float)(_size - 1)));
+    int x0 = (int)floorf(p.x);
+    int y0 = (int)floorf(p.y);
+    int x1 = std::min(x0 + 1, _size - 1);
+    int y1 = std::min(y0 + 1, _size - 1);
+    float tx = p.x - (float)x0;
+    float ty = p.y - (float)y0;
+    float d0 = LoadFront(x0, y0) + (LoadFront(x1, y0) - LoadFront(x0, y0)) * tx;
+    float d1 = LoadFront(x0, y1) + (LoadFront(x1, y1) - LoadFront(x0, y1)) * tx;
+    return d0 + (d1 - d0) * ty;
+}
+
+glm::vec2 SDFEditWorker::GetDecodeScaleBias() const {
+    switch (_format) {
+    default:
+    case FloatFormat:
+    case HalfFormat:
+        return glm::vec2(1.0f, 0.0f);
+    case Unorm16Format:
+    case Unorm8Format:
+        return glm::vec2(2.0f * _band, -_band);
+    }
+}
+
+// copies rect from the scene's buffers into the front buffers, converting to the front format.
+// Scenes with layers are composited a row at a time on the way.
+void SDFEditWorker::CopyToFront(const SDFRect& rect) {
+    bool composite = _scene->GetNumLayers() > 0;
+    int width = rect.x1 - rect.x0;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        int offset = y * _size + rect.x0;
+        const float* row = _scene->GetBuffer() + offset;
+        const uint16_t* idRow = _scene->GetIdBuffer() + offset;
+        if (composite) {
+            _scene->CompositeRow(y, rect.x0, width, _compositeRow.data(), _compositeIdRow.data());
+            row = _compositeRow.data();
+            idRow = _compositeIdRow.data();
+        }
+        switch (_format) {
+        default:
+        case FloatFormat:
+            memcpy(_frontBuffer + offset, row, width * sizeof(float));
+            break;
+        case HalfFormat:
+            float_to_half_row(row, _frontHalfBuffer + offset, width);
+            half_to_float_row(_frontHalfBuffer + offset, _decodedRow.data(), width);
+            break;
+        case Unorm16Format:
+            distance_to_unorm16_row(row, _frontUnorm16Buffer + offset, width, _band, rect.x0, y, _dither);
+            unorm16_to_distance_row(_frontUnorm16Buffer + offset, _decodedRow.data(), width, _band);
+            break;
+        case Unorm8Format:
+            distance_to_unorm8_row(row, _frontUnorm8Buffer + offset, width, _band, rect.x0, y, _dither);
+            unorm8_to_distance_row(_frontUnorm8Buffer + offset, _decodedRow.data(), width, _band);
+            break;
+        }
+        if (_format != FloatFormat) {
+            _errorStats.AccumulateRow(row, _decodedRow.data(), width, _band);
+        }
+        memcpy(_frontIdBuffer + offset, idRow, width * sizeof(uint16_t));
+    }
+}
+
+float SDFEditWorker::LoadFront(int x, int y) const {
+    int offset = y * _size + x;
+    switch (_format) {
+    default:
+    case FloatFormat:
+        return _frontBuffer[offset];
+    case HalfFormat:
+        return half_to_float(_frontHalfBuffer[offset]);
+    case Unorm16Format:
+        return unorm16_to_distance(_frontUnorm16Buffer[offset], _band);
+    case Unorm8Format:
+        return unorm8_to_distance(_frontUnorm8Buffer[offset], _band);
+    }
+}
+
+int SDFEditWorker::GetNumPending() const {
+    return (int)_queue.GetSize();
+}
+
+void SDFEditWorker::EndStep() {
+    std::lock_guard<std::mutex> lock(_stepMutex);
+    _stepEnds.push_back(_numPosted.load());
+}
+
+bool SDFEditWorker::Undo() {
+    return ApplyHistory(true);
+}
+
+bool SDFEditWorker::Redo() {
+    return ApplyHistory(false);
+}
+
+bool SDFEditWorker::ApplyHistory(bool undo) {
+    SDFHistory* history = _scene->GetHistory();
+    if (!history) {
+        return false;
+    }
+    // every edit posted so far comes before the undo.  A Sync() that found the worker
+    // busy would hold it off until the next frame, release it.
+    {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _syncRequested = false;
+    }
+    _syncCond.notify_one();
+    while (_numApplied.load() < _numPosted.load()) {
+        std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    CommitSteps();
+    return undo ? history->Undo(*_scene) : history->Redo(*_scene);
+}
+
+// number of edits the worker can apply before reaching the next step boundary.
+uint64_t SDFEditWorker::GetEditsBeforeStepEnd() {
+    std::lock_guard<std::mutex> lock(_stepMutex);
+    uint64_t applied = _numApplied.load();
+    for (size_t i = 0; i < _stepEnds.size(); i++) {
+        if (_stepEnds[i] > applied) {
+            return _stepEnds[i] - applied;
+        }
+    }
+    return UINT64_MAX;
+}
+
+// commits the history step of every boundary reached, call with _bufferMutex held.
+void SDFEditWorker::CommitSteps() {
+    bool reached = false;
+    {
+        std::lock_guard<std::mutex> lock(_stepMutex);
+        while (!_stepEnds.empty() && _stepEnds.front() <= _numApplied.load()) {
+            _stepEnds.pop_front();
+            reached = true;
+        }
+    }
+    SDFHistory* history = _scene->GetHistory();
+    if (reached && history) {
+        history->Commit(*_scene);
+    }
+}
+
+void SDFEditWorker::Run() {
+    std::vector<SDFEdit> batch(MAX_BATCH_SIZE);
+    std::vector<SDFEdit> edits;
+    while (true) {
+        size_t count = _queue.PopBatch(batch.data(), MAX_BATCH_SIZE);
+        if (count == 0 && _scene->GetBakeStep() > 1 && !_quit) {
+            // refine a progressive bake a level at a time while there are no edits,
+            // each level is published by the next Sync().
+            std::unique_lock<std::mutex> bufferLock(_bufferMutex);
+            _syncCond.wait(bufferLock, [this]() { return !_syncRequested || _quit; });
+            _baking = !_scene->RefineBake();
+            continue;
+        }
+        if (count == 0) {
+            std::unique_lock<std::mutex> wakeLock(_wakeMutex);
+            _sleeping = true;
+            _wakeCond.wait(wakeLock, [this]() { return _quit || !_queue.IsEmpty(); });
+            _sleeping = false;
+            if (_quit) {
+                break;
+            }
+            continue;
+        }
+        if (_quit) {
+            break;
+        }
+
+        // a batch is split at undo step boundaries, so no pass spans two steps.
+        size_t begin = 0;
+        while (begin < count) {
+            size_t end = begin + (size_t)std::min((uint64_t)(count - begin), GetEditsBeforeStepEnd());
+            for (size_t i = begin; i < end; i++) {
+                bool covered = false;
+                for (size_t j = i + 1; j < end && !covered; j++) {
+                    covered = batch[j].Covers(batch[i]);
+                }
+                if (!covered) {
+                    edits.push_back(batch[i]);
+                }
+            }
+
+            {
+                // the whole batch is applied in one pass over the buffer, a tile at a time.
+                // A Sync() that found us mid-batch gets the buffer at the next tile, and
+                // publishes the tiles done so far.
+                std::unique_lock<std::mutex> bufferLock(_bufferMutex);
+                _syncCond.wait(bufferLock, [this]() { return !_syncRequested || _quit; });
+                CommitSteps();
+                _scene->BeginEdits(edits);
+                while (!_scene->StepEdits(1)) {
+                    _syncCond.wait(bufferLock, [this]() { return !_syncRequested || _quit; });
+                }
+                // an edit that goes to a history finishes the bake
+                _baking = _scene->GetBakeStep() > 1;
+                _numApplied += end - begin;
+                CommitSteps();
+            }
+
+            edits.clear();
+            begin = end;
+        }
+        for (size_t i = 0; i < count; i++) {
+            batch[i].poly.reset();
+            batch[i].proto.reset();
+        }
+    }
+}
@@ -0,0 +1,174 @@
+//
+//  sdfeditworker.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFEditWorker_h
+#define hifi_SDFEditWorker_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sdfeditqueue.h"
+#include "sdfscene.h"
+#include "unorm.h"
+
+// Applies edits to an SDFScene on a worker thread.
+// The scene's own buffers become the back buffer, owned by the worker.  The render
+// thread reads a front copy which Sync() brings up to date once per frame by copying
+// only the texels the worker touched, so rendering never waits on an edit.  A scene
+// constructed with SDFScene::ProgressiveFlag has its bake refined by the worker whenever
+// there are no edits to apply.
+class SDFEditWorker {
+public:
+    // storage for the front distance buffer.  The back buffer stays float so repeated
+    // edits don't accumulate rounding, only the copy the renderer reads is narrowed.
+    enum Format {
+        FloatFormat = 0,
+        HalfFormat,      // IEEE half floats, half the memory and upload of float
+        Unorm16Format,   // [-band, band] as normalized 16-bit, see unorm.h
+        Unorm8Format     // [-band, band] as normalized 8-bit, a quarter of float
+    };
+
+    // band is the distance range the unorm formats cover, and the error stats of any
+    // format only count texels inside it.  dither only applies to the unorm formats.
+    SDFEditWorker(SDFScene* scene, Format format = FloatFormat, float band = 0.25f, bool dither = false);
+
+    // stops the worker, edits that have not started yet are discarded.
+    ~SDFEditWorker();
+
+    // queue an edit, any thread, without taking a lock.  Blocks only while the queue is full.
+    // Edits covered by a later edit in the same batch are dropped by the worker.
+    void Post(const SDFEdit& edit);
+
+    // call at a frame boundary from the render thread.  Publishes every edit finished
+    // since the last Sync(), returns false if the worker was mid-edit, in which case
+    // it pauses after the tile it is on and the next Sync() is guaranteed to go through.
+    // A large batch is published a tile at a time as the worker gets through it.
+    //
+    // With a budget, copying to the front stops between tiles once budgetMs is spent,
+    // those left over keep their previous state and go first next time, see
+    // HasPendingTiles().  Zero copies everything.
+    bool Sync(float budgetMs = 0.0f);
+
+    // true while texels the worker has finished are still waiting to be copied to the front.
+    bool HasPendingTiles() const;
+
+    // true while a later Sync() could still change the front buffers without anything new
+    // being posted: edits or layer prims in flight, tiles waiting, or a bake being refined.
+    // The worker doesn't signal when it is done, poll Sync() until this goes false.
+    // Render thread only.
+    bool IsBusy() const;
+
+    // replaces the prims of one of the scene's dynamic layers, see SDFScene::SetLayerPrims().
+    // Held until the next Sync() that goes through, a later call for the same layer replaces
+    // an earlier one.  Layers must be added to the scene before the worker is created.
+    // Render thread only.
+    void SetLayerPrims(int layer, const std::vector<SDFEdit>& prims);
+
+    // front buffers, only valid on the render thread, with the scene's layers composited.
+    // the distance buffer is only available in the format the worker was created with,
+    // the other accessor returns NULL.
+    int GetSize() const { return _size; }
+    Format GetFormat() const { return _format; }
+    const float* GetBuffer() const { return _frontBuffer; }
+    const uint16_t* GetHalfBuffer() const { return _frontHalfBuffer; }
+    const uint16_t* GetUnorm16Buffer() const { return _frontUnorm16Buffer; }
+    const uint8_t* GetUnorm8Buffer() const { return _frontUnorm8Buffer; }
+    float GetBand() const { return _band; }
+    const uint16_t* GetIdBuffer() const { return _frontIdBuffer; }
+    const SDFRect& GetDirtyRect() const { return _frontDirtyRect; }
+    void ClearDirtyRect() { _frontDirtyRect = SDFRect(); }
+
+    // bilinear sample of the front distance buffer at a world space point, in any
+    // format.  Points outside the buffer are clamped to its edge.  Render thread only.
+    float SampleDistance(const glm::vec2& worldPoint) const;
+
+    // distance = texel * scale + bias, for a texel read back normalized to [0, 1] as the
+    // gpu does for the unorm formats.  (1, 0) for the float formats.
+    glm::vec2 GetDecodeScaleBias() const;
+
+    // error of the front buffer against the float back buffer, gathered by every Sync()
+    // over the texels it copied.  Always empty for FloatFormat.  Render thread only.
+    const EncodingErrorStats& GetErrorStats() const { return _errorStats; }
+    void ResetErrorStats() { _errorStats = EncodingErrorStats(); }
+
+    // number of edits that have been posted but not applied yet.
+    int GetNumPending() const;
+
+    // undo steps of the scene's SDFHistory, if it has one.  EndStep() closes the step
+    // after the edits posted so far, a batch is split at the boundary.  Undo() and Redo()
+    // wait for every posted edit to be applied, then restore tiles in the back buffer,
+    // the next Sync() publishes them.  Render thread only.
+    void EndStep();
+    bool Undo();
+    bool Redo();
+
+protected:
+    void Run();
+    uint64_t GetEditsBeforeStepEnd();
+    void CommitSteps();
+    bool ApplyHistory(bool undo);
+    void MarkPending(const SDFRect& rect);
+    void CopyPending(float budgetMs);
+    void CopyToFront(const SDFRect& rect);
+    float LoadFront(int x, int y) const;
+
+    SDFScene* _scene;
+    int _size;
+    Format _format;
+    float _band;
+    bool _dither;
+    float* _frontBuffer;
+    uint16_t* _frontHalfBuffer;
+    uint16_t* _frontUnorm16Buffer;
+    uint8_t* _frontUnorm8Buffer;
+    std::vector<float> _decodedRow;
+    std::vector<float> _compositeRow;
+    std::vector<uint16_t> _compositeIdRow;
+    std::vector<std::vector<SDFEdit> > _layerPrims;  // per layer, waiting for Sync()
+    std::vector<bool> _layerPending;
+    EncodingErrorStats _errorStats;
+    uint16_t* _frontIdBuffer;
+    SDFRect _frontDirtyRect;
+
+    // per tile, the texels finished in the back buffer but not yet copied to the front.
+    std::vector<SDFRect> _pendingTiles;
+    int _tilesPerRow;
+    int _numPendingTiles;
+    int _nextPendingTile;
+
+    SDFEditQueue _queue;
+    std::atomic<bool> _quit;
+
+    // producers only touch the mutex to wake the worker once it has gone to sleep.
+    std::mutex _wakeMutex;
+    std::condition_variable _wakeCond;
+    std::atomic<bool> _sleeping;
+
+    // held by the worker while it writes the back buffer
+    std::mutex _bufferMutex;
+    std::condition_variable _syncCond;
+    std::atomic<bool> _syncRequested;
+
+    // the scene's bake is still being refined, see SDFScene::ProgressiveFlag.
+    std::atomic<bool> _baking;
+
+    // edits posted and applied, including ones dropped as covered.
+    std::atomic<uint64_t> _numPosted;
+    std::atomic<uint64_t> _numApplied;
+
+    // _numPosted at each EndStep() not yet reached by the worker.
+    std::mutex _stepMutex;
+    std::deque<uint64_t> _stepEnds;
+
+    std::thread _thread;
+};
+
+#endif
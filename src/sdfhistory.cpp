@@ -0,0 +1,175 @@
+//
+//  sdfhistory.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfhistory.h"
+#include "sdfjournal.h"
+
+#include <algorithm>
+#include <string.h>
+
+const int SDFHistory::TILE_SIZE;
+
+SDFHistory::Tile::~Tile() {
+    *memoryUsed -= dist.capacity() * sizeof(float) + ids.capacity() * sizeof(uint16_t) + grad.capacity() * sizeof(float);
+}
+
+SDFHistory::SDFHistory(size_t memoryCap) : _memoryCap(memoryCap), _memoryUsed(0), _size(0), _tilesPerRow(0), _hasOpen(false) {
+}
+
+SDFHistory::~SDFHistory() {
+    // tiles decrement _memoryUsed as they go, so drop them while it still exists.
+    _undo.clear();
+    _redo.clear();
+    _open.changes.clear();
+    _current.clear();
+}
+
+void SDFHistory::Init(const SDFScene& scene) {
+    if (_size == scene.GetSize()) {
+        return;
+    }
+    _size = scene.GetSize();
+    _tilesPerRow = (_size + TILE_SIZE - 1) / TILE_SIZE;
+    _openChange.assign(_tilesPerRow * _tilesPerRow, -1);
+    _current.assign(_tilesPerRow * _tilesPerRow, TilePtr());
+}
+
+void SDFHistory::Capture(const SDFScene& scene, const SDFRect& rect) {
+    Init(scene);
+    SDFRect clipped = rect.Intersect(SDFRect(0, 0, _size, _size));
+    if (clipped.IsEmpty() || scene.GetQuadtree()) {
+        return;
+    }
+    if (!_hasOpen) {
+        _redo.clear();
+        _hasOpen = true;
+    }
+
+    for (int ty = clipped.y0 / TILE_SIZE; ty <= (clipped.y1 - 1) / TILE_SIZE; ty++) {
+        for (int tx = clipped.x0 / TILE_SIZE; tx <= (clipped.x1 - 1) / TILE_SIZE; tx++) {
+            int tile = ty * _tilesPerRow + tx;
+            if (_openChange[tile] >= 0) {
+                continue;
+            }
+            Change change;
+            change.tile = tile;
+            change.before = _current[tile] ? _current[tile] : CopyTile(scene, tile);
+            _openChange[tile] = (int)_open.changes.size();
+            _open.changes.push_back(change);
+            // the scene is about to change under it
+            _current[tile].reset();
+        }
+    }
+}
+
+void SDFHistory::Commit(const SDFScene& scene) {
+    Init(scene);
+    if (!_hasOpen) {
+        return;
+    }
+    for (size_t i = 0; i < _open.changes.size(); i++) {
+        Change& change = _open.changes[i];
+        change.after = CopyTile(scene, change.tile);
+        _current[change.tile] = change.after;
+        _openChange[change.tile] = -1;
+    }
+    _undo.push_back(Step());
+    _undo.back().changes.swap(_open.changes);
+    _hasOpen = false;
+    Evict();
+}
+
+bool SDFHistory::Undo(SDFScene& scene) {
+    Commit(scene);
+    if (_undo.empty()) {
+        return false;
+    }
+    Step& step = _undo.back();
+    for (size_t i = 0; i < step.changes.size(); i++) {
+        RestoreTile(scene, step.changes[i].tile, step.changes[i].before);
+    }
+    _redo.push_back(Step());
+    _redo.back().changes.swap(step.changes);
+    _undo.pop_back();
+    if (scene._journal) {
+        scene._journal->Compact(scene);
+    }
+    return true;
+}
+
+bool SDFHistory::Redo(SDFScene& scene) {
+    Commit(scene);
+    if (_redo.empty()) {
+        return false;
+    }
+    Step& step = _redo.back();
+    for (size_t i = 0; i < step.changes.size(); i++) {
+        RestoreTile(scene, step.changes[i].tile, step.changes[i].after);
+    }
+    _undo.push_back(Step());
+    _undo.back().changes.swap(step.changes);
+    _redo.pop_back();
+    if (scene._journal) {
+        scene._journal->Compact(scene);
+    }
+    return true;
+}
+
+SDFRect SDFHistory::GetTileRect(int tile) const {
+    int x0 = (tile % _tilesPerRow) * TILE_SIZE;
+    int y0 = (tile / _tilesPerRow) * TILE_SIZE;
+    return SDFRect(x0, y0, std::min(x0 + TILE_SIZE, _size), std::min(y0 + TILE_SIZE, _size));
+}
+
+SDFHistory::TilePtr SDFHistory::CopyTile(const SDFScene& scene, int tile) {
+    SDFRect rect = GetTileRect(tile);
+    int w = rect.x1 - rect.x0;
+    int h = rect.y1 - rect.y0;
+    std::shared_ptr<Tile> copy = std::make_shared<Tile>(&_memoryUsed);
+    copy->dist.resize(w * h);
+    copy->ids.resize(w * h);
+    if (scene.GetGradientBuffer()) {
+        copy->grad.resize(2 * w * h);
+    }
+    for (int y = 0; y < h; y++) {
+        int offset = (rect.y0 + y) * _size + rect.x0;
+        memcpy(&copy->dist[y * w], scene.GetBuffer() + offset, w * sizeof(float));
+        memcpy(&copy->ids[y * w], scene.GetIdBuffer() + offset, w * sizeof(uint16_t));
+        if (scene.GetGradientBuffer()) {
+            memcpy(&copy->grad[2 * y * w], scene.GetGradientBuffer() + 2 * offset, 2 * w * sizeof(float));
+        }
+    }
+    _memoryUsed += copy->dist.capacity() * sizeof(float) + copy->ids.capacity() * sizeof(uint16_t) + copy->grad.capacity() * sizeof(float);
+    return copy;
+}
+
+void SDFHistory::RestoreTile(SDFScene& scene, int tile, const TilePtr& copy) {
+    SDFRect rect = GetTileRect(tile);
+    int w = rect.x1 - rect.x0;
+    int h = rect.y1 - rect.y0;
+    for (int y = 0; y < h; y++) {
+        int offset = (rect.y0 + y) * _size + rect.x0;
+        memcpy(scene._buffer + offset, &copy->dist[y * w], w * sizeof(float));
+        memcpy(scene._idBuffer + offset, &copy->ids[y * w], w * sizeof(uint16_t));
+        if (scene._gradBuffer && !copy->grad.empty()) {
+            memcpy(scene._gradBuffer + 2 * offset, &copy->grad[2 * y * w], 2 * w * sizeof(float));
+        }
+    }
+    _current[tile] = copy;
+    scene._dirtyRect = scene._dirtyRect.Union(rect);
+}
+
+// forgets the oldest undo steps, then the furthest redo steps, until under the cap.
+// Tiles still shared with a newer step or _current stay alive.
+void SDFHistory::Evict() {
+    while (_memoryUsed > _memoryCap && !_undo.empty()) {
+        _undo.pop_front();
+    }
+    while (_memoryUsed > _memoryCap && !_redo.empty()) {
+        _redo.erase(_redo.begin());
+    }
+}
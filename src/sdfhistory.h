@@ -0,0 +1,96 @@
+//
+//  sdfhistory.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFHistory_h
+#define hifi_SDFHistory_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "sdfscene.h"
+
+// Undo and redo for an SDFScene, saving only the tiles each step touched.
+//
+// A step holds the before and after copy of every tile it changed.  Copies are
+// immutable and shared, the after copy of a tile is reused as the before copy of
+// the next step that touches it, so each version of a tile is stored once however
+// many steps refer to it.  When the copies add up to more than the memory cap the
+// oldest steps are forgotten.
+//
+// Attach with SDFScene::SetHistory(), the scene calls Capture() before every edit.
+// Not for scenes with an adaptive store, which can't be restored from their buffers.
+class SDFHistory {
+public:
+    static const int TILE_SIZE = 32;
+
+    SDFHistory(size_t memoryCap = 64 * 1024 * 1024);
+    ~SDFHistory();
+
+    // saves the tiles of rect not yet saved by the open step, opening one if needed.
+    // Call before the scene modifies rect, a new step throws away everything undone.
+    void Capture(const SDFScene& scene, const SDFRect& rect);
+
+    // closes the open step, if any, so the next edit starts a new one.
+    void Commit(const SDFScene& scene);
+
+    // restores the tiles of the last step, or reapplies the last undone one, and adds
+    // them to the scene's dirty rect.  An open step is committed first.  False if there
+    // is nothing to undo or redo.  A journal attached to the scene is compacted, undo
+    // isn't an edit it could replay.
+    bool Undo(SDFScene& scene);
+    bool Redo(SDFScene& scene);
+
+    size_t GetNumUndoSteps() const { return _undo.size(); }
+    size_t GetNumRedoSteps() const { return _redo.size(); }
+
+    // bytes held by tile copies, shared copies are counted once.
+    size_t GetMemoryUsed() const { return _memoryUsed; }
+
+protected:
+    // one tile's texels at one point in time.
+    struct Tile {
+        Tile(size_t* memoryUsedIn) : memoryUsed(memoryUsedIn) {}
+        ~Tile();
+
+        size_t* memoryUsed;
+        std::vector<float> dist;
+        std::vector<uint16_t> ids;
+        std::vector<float> grad;
+    };
+    typedef std::shared_ptr<const Tile> TilePtr;
+
+    struct Change {
+        int tile;
+        TilePtr before, after;
+    };
+
+    struct Step {
+        std::vector<Change> changes;
+    };
+
+    void Init(const SDFScene& scene);
+    SDFRect GetTileRect(int tile) const;
+    TilePtr CopyTile(const SDFScene& scene, int tile);
+    void RestoreTile(SDFScene& scene, int tile, const TilePtr& copy);
+    void Evict();
+
+    size_t _memoryCap;
+    size_t _memoryUsed;
+    int _size;
+    int _tilesPerRow;
+    std::deque<Step> _undo;  // oldest first
+    std::vector<Step> _redo; // most recently undone last
+    Step _open;
+    bool _hasOpen;
+    std::vector<int> _openChange;   // per tile, index into _open.changes or -1
+    std::vector<TilePtr> _current;  // per tile, a copy known to match the scene, or NULL
+};
+
+#endif
@@ -0,0 +1,399 @@
+//
+//  sdfjournal.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfjournal.h"
+#include "sdfpolygon.h"
+#include "sdfprototype.h"
+#include "sdfquadtree.h"
+#include "sdftilecodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+// file layout, little endian: "SDFJ", uint32_t version, then records of
+// uint8_t tag, uint32_t payload length, payload.  A checkpoint record replaces
+// everything before it.
+static const char MAGIC[4] = { 'S', 'D', 'F', 'J' };
+static const uint32_t VERSION = 1;
+static const uint8_t EDIT_TAG = 'E';
+static const uint8_t CHECKPOINT_TAG = 'C';
+
+// well past any record written here, a checkpoint of a 512 x 512 float buffer with
+// gradients is about 3 MB.  A longer length can only come from a torn or corrupt record.
+static const uint32_t MAX_RECORD_SIZE = 64 * 1024 * 1024;
+
+// edits handed to ApplyEdits() at once during replay.
+static const size_t REPLAY_BATCH_SIZE = 64;
+
+template <typename T>
+static void put(std::vector<uint8_t>& out, T value) {
+    size_t offset = out.size();
+    out.resize(offset + sizeof(T));
+    memcpy(out.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+static bool get(const uint8_t*& ptr, const uint8_t* end, T& value) {
+    if ((size_t)(end - ptr) < sizeof(T)) {
+        return false;
+    }
+    memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return true;
+}
+
+static uint64_t now_micros() {
+    auto since = std::chrono::system_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(since).count();
+}
+
+// prototypes nest their own edits, replay bakes them again.
+static const int MAX_PROTOTYPE_DEPTH = 8;
+
+static void write_edit(std::vector<uint8_t>& out, const SDFEdit& edit) {
+    put<uint8_t>(out, (uint8_t)edit.op);
+    put<uint8_t>(out, (uint8_t)edit.type);
+    put<uint16_t>(out, edit.id);
+    put<float>(out, edit.pos.x);
+    put<float>(out, edit.pos.y);
+    put<float>(out, edit.angle);
+    put<float>(out, edit.r.x);
+    put<float>(out, edit.r.y);
+    put<float>(out, edit.k);
+    uint32_t numPoints = edit.poly ? (uint32_t)edit.poly->GetPoints().size() : 0;
+    put<uint32_t>(out, numPoints);
+    for (uint32_t i = 0; i < numPoints; i++) {
+        put<float>(out, edit.poly->GetPoints()[i].x);
+        put<float>(out, edit.poly->GetPoints()[i].y);
+    }
+    if (edit.type == SDFEdit::Instance) {
+        const std::vector<SDFEdit>& protoEdits = edit.proto->GetEdits();
+        put<uint32_t>(out, (uint32_t)protoEdits.size());
+        for (size_t i = 0; i < protoEdits.size(); i++) {
+            write_edit(out, protoEdits[i]);
+        }
+    }
+}
+
+static bool read_edit(const uint8_t*& ptr, const uint8_t* end, SDFEdit& edit, int depth) {
+    uint8_t op, type;
+    uint32_t numPoints;
+    if (!get(ptr, end, op) || !get(ptr, end, type) ||
+        !get(ptr, end, edit.id) || !get(ptr, end, edit.pos.x) || !get(ptr, end, edit.pos.y) || !get(ptr, end, edit.angle) ||
+        !get(ptr, end, edit.r.x) || !get(ptr, end, edit.r.y) || !get(ptr, end, edit.k) || !get(ptr, end, numPoints)) {
+        return false;
+    }
+    if (op > SDFEdit::Rem || type > SDFEdit::Instance || (size_t)(end - ptr) / (2 * sizeof(float)) < numPoints) {
+        return false;
+    }
+    edit.op = (SDFEdit::Op)op;
+    edit.type = (SDFEdit::Type)type;
+    edit.poly.reset();
+    edit.proto.reset();
+    if (edit.type == SDFEdit::Polygon || edit.type == SDFEdit::Polyline) {
+        if (numPoints == 0) {
+            return false;
+        }
+        std::vector<glm::vec2> points(numPoints);
+        for (uint32_t i = 0; i < numPoints; i++) {
+            get(ptr, end, points[i].x);
+            get(ptr, end, points[i].y);
+        }
+        edit.poly = std::make_shared<SDFPolygon>(points, edit.type == SDFEdit::Polygon);
+    } else if (edit.type == SDFEdit::Instance) {
+        uint32_t numEdits;
+        if (numPoints != 0 || depth >= MAX_PROTOTYPE_DEPTH || !get(ptr, end, numEdits)) {
+            return false;
+        }
+        std::vector<SDFEdit> protoEdits;
+        for (uint32_t i = 0; i < numEdits; i++) {
+            SDFEdit protoEdit;
+            if (!read_edit(ptr, end, protoEdit, depth + 1)) {
+                return false;
+            }
+            protoEdits.push_back(protoEdit);
+        }
+        edit.proto = SDFScene::BakePrototype(protoEdits);
+    } else if (numPoints != 0) {
+        return false;
+    }
+    return true;
+}
+
+static void write_entry(std::vector<uint8_t>& out, const SDFJournal::Entry& entry) {
+    put<uint64_t>(out, entry.seq);
+    put<uint64_t>(out, entry.timestamp);
+    write_edit(out, entry.edit);
+}
+
+static bool read_entry(const uint8_t* ptr, const uint8_t* end, SDFJournal::Entry& entry) {
+    if (!get(ptr, end, entry.seq) || !get(ptr, end, entry.timestamp)) {
+        return false;
+    }
+    return read_edit(ptr, end, entry.edit, 0);
+}
+
+SDFJournal::SDFJournal(uint32_t checkpointInterval) : _checkpointInterval(checkpointInterval), _numRecorded(0), _hasCheckpoint(false), _file(NULL) {
+}
+
+SDFJournal::~SDFJournal() {
+    Close();
+}
+
+bool SDFJournal::Open(const char* filename) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+    _filename = filename;
+    _entries.clear();
+    _hasCheckpoint = false;
+    _numRecorded = 0;
+
+    FILE* file = fopen(filename, "rb");
+    if (file) {
+        char magic[4];
+        uint32_t version;
+        if (fread(magic, sizeof(magic), 1, file) == 1 && fread(&version, sizeof(version), 1, file) == 1 &&
+            memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 && version == VERSION) {
+            long start = ftell(file);
+            fseek(file, 0, SEEK_END);
+            long fileSize = ftell(file);
+            fseek(file, start, SEEK_SET);
+            std::vector<uint8_t> payload;
+            uint8_t tag;
+            uint32_t length;
+            while (fread(&tag, sizeof(tag), 1, file) == 1 && fread(&length, sizeof(length), 1, file) == 1) {
+                // check the length before allocating for it
+                long left = fileSize - ftell(file);
+                if (length > MAX_RECORD_SIZE || (long)length > left) {
+                    fprintf(stderr, "SDFJournal: dropping a torn record at the end of %s\n", filename);
+                    break;
+                }
+                payload.resize(length);
+                if (length > 0 && fread(payload.data(), length, 1, file) != 1) {
+                    fprintf(stderr, "SDFJournal: dropping a truncated record at the end of %s\n", filename);
+                    break;
+                }
+                const uint8_t* ptr = payload.data();
+                const uint8_t* end = ptr + payload.size();
+                if (tag == EDIT_TAG) {
+                    Entry entry;
+                    if (!read_entry(ptr, end, entry)) {
+                        fprintf(stderr, "SDFJournal: bad edit record in %s\n", filename);
+                        break;
+                    }
+                    _entries.push_back(entry);
+                    _numRecorded = entry.seq + 1;
+                } else if (tag == CHECKPOINT_TAG) {
+                    Checkpoint checkpoint;
+                    uint32_t dataLength, gradLength;
+                    if (!get(ptr, end, checkpoint.seq) || !get(ptr, end, checkpoint.nextId) || !get(ptr, end, checkpoint.size) ||
+                        !get(ptr, end, dataLength) || (size_t)(end - ptr) < dataLength) {
+                        fprintf(stderr, "SDFJournal: bad checkpoint record in %s\n", filename);
+                        break;
+                    }
+                    checkpoint.data.assign(ptr, ptr + dataLength);
+                    ptr += dataLength;
+                    if (!get(ptr, end, gradLength) || (size_t)(end - ptr) / sizeof(float) < gradLength) {
+                        fprintf(stderr, "SDFJournal: bad checkpoint record in %s\n", filename);
+                        break;
+                    }
+                    checkpoint.grad.resize(gradLength);
+                    memcpy(checkpoint.grad.data(), ptr, gradLength * sizeof(float));
+                    _checkpoint = checkpoint;
+                    _hasCheckpoint = true;
+                    _entries.clear();
+                    _numRecorded = checkpoint.seq;
+                } else {
+                    fprintf(stderr, "SDFJournal: unknown record in %s\n", filename);
+                    break;
+                }
+            }
+        } else {
+            fprintf(stderr, "SDFJournal: %s is not a journal, starting a new one\n", filename);
+        }
+        fclose(file);
+    }
+
+    // rewriting drops any partial record, so appends start on a record boundary.
+    return Rewrite();
+}
+
+void SDFJournal::Close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+}
+
+void SDFJournal::Record(const SDFScene& scene, const std::vector<SDFEdit>& edits, const std::vector<uint16_t>& ids) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t timestamp = now_micros();
+    std::vector<uint8_t> payload;
+    for (size_t i = 0; i < edits.size(); i++) {
+        Entry entry;
+        entry.seq = _numRecorded++;
+        entry.timestamp = timestamp;
+        entry.edit = edits[i];
+        entry.edit.id = ids[i];
+        _entries.push_back(entry);
+        if (_file) {
+            payload.clear();
+            write_entry(payload, entry);
+            WriteRecord(_file, EDIT_TAG, payload);
+        }
+    }
+    if (_file) {
+        fflush(_file);
+    }
+
+    if (_checkpointInterval > 0 && _entries.size() >= _checkpointInterval) {
+        CompactLocked(scene);
+    }
+}
+
+bool SDFJournal::Compact(const SDFScene& scene) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return CompactLocked(scene);
+}
+
+bool SDFJournal::CompactLocked(const SDFScene& scene) {
+    if (scene.GetQuadtree()) {
+        return false;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.seq = _numRecorded;
+    checkpoint.nextId = scene._nextId.load();
+    checkpoint.size = scene.GetSize();
+    SDFTileEncoder encoder;
+    encoder.Encode(scene.GetBuffer(), scene.GetIdBuffer(), scene.GetSize(), SDFRect(0, 0, scene.GetSize(), scene.GetSize()), checkpoint.data);
+    if (scene.GetGradientBuffer()) {
+        checkpoint.grad.assign(scene.GetGradientBuffer(), scene.GetGradientBuffer() + 2 * scene.GetSize() * scene.GetSize());
+    }
+
+    _checkpoint.data.swap(checkpoint.data);
+    _checkpoint.grad.swap(checkpoint.grad);
+    _checkpoint.seq = checkpoint.seq;
+    _checkpoint.nextId = checkpoint.nextId;
+    _checkpoint.size = checkpoint.size;
+    _hasCheckpoint = true;
+    _entries.clear();
+    return _filename.empty() || Rewrite();
+}
+
+// writes the checkpoint and entries to a new file which then replaces the old one,
+// a crash part way leaves the old file intact.  Leaves _file open for appends.
+bool SDFJournal::Rewrite() {
+    if (_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+    std::string tempFilename = _filename + ".tmp";
+    FILE* file = fopen(tempFilename.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "SDFJournal: can't write %s\n", tempFilename.c_str());
+        return false;
+    }
+    fwrite(MAGIC, sizeof(MAGIC), 1, file);
+    fwrite(&VERSION, sizeof(VERSION), 1, file);
+
+    std::vector<uint8_t> payload;
+    if (_hasCheckpoint) {
+        put<uint64_t>(payload, _checkpoint.seq);
+        put<uint16_t>(payload, _checkpoint.nextId);
+        put<int32_t>(payload, _checkpoint.size);
+        put<uint32_t>(payload, (uint32_t)_checkpoint.data.size());
+        payload.insert(payload.end(), _checkpoint.data.begin(), _checkpoint.data.end());
+        put<uint32_t>(payload, (uint32_t)_checkpoint.grad.size());
+        const uint8_t* grad = (const uint8_t*)_checkpoint.grad.data();
+        payload.insert(payload.end(), grad, grad + _checkpoint.grad.size() * sizeof(float));
+        WriteRecord(file, CHECKPOINT_TAG, payload);
+    }
+    for (size_t i = 0; i < _entries.size(); i++) {
+        payload.clear();
+        write_entry(payload, _entries[i]);
+        WriteRecord(file, EDIT_TAG, payload);
+    }
+    bool ok = fflush(file) == 0;
+    fclose(file);
+
+    // rename doesn't replace an existing file everywhere
+    if (!ok || (rename(tempFilename.c_str(), _filename.c_str()) != 0 &&
+                (remove(_filename.c_str()) != 0 || rename(tempFilename.c_str(), _filename.c_str()) != 0))) {
+        fprintf(stderr, "SDFJournal: can't replace %s\n", _filename.c_str());
+        return false;
+    }
+    _file = fopen(_filename.c_str(), "ab");
+    return _file != NULL;
+}
+
+void SDFJournal::WriteRecord(FILE* file, uint8_t tag, const std::vector<uint8_t>& payload) {
+    uint32_t length = (uint32_t)payload.size();
+    fwrite(&tag, sizeof(tag), 1, file);
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(payload.data(), 1, payload.size(), file);
+}
+
+bool SDFJournal::Replay(SDFScene& scene) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint16_t nextId = scene._nextId.load();
+    if (_hasCheckpoint) {
+        bool hasGrad = scene.GetGradientBuffer() != NULL;
+        if (scene.GetQuadtree() || _checkpoint.size != scene.GetSize() || hasGrad != !_checkpoint.grad.empty()) {
+            fprintf(stderr, "SDFJournal: checkpoint doesn't fit the scene\n");
+            return false;
+        }
+        SDFTileDecoder decoder;
+        if (!decoder.Open(_checkpoint.data.data(), _checkpoint.data.size()) || !decoder.HasIds() ||
+            !decoder.Decode(scene._buffer, scene._idBuffer, scene.GetSize())) {
+            fprintf(stderr, "SDFJournal: corrupt checkpoint\n");
+            return false;
+        }
+        if (hasGrad) {
+            memcpy(scene._gradBuffer, _checkpoint.grad.data(), _checkpoint.grad.size() * sizeof(float));
+        }
+        nextId = std::max(nextId, _checkpoint.nextId);
+        scene._dirtyRect = SDFRect(0, 0, scene.GetSize(), scene.GetSize());
+        scene.SkipBake();
+    }
+
+    // the scene must not record its own replay
+    SDFJournal* journal = scene._journal;
+    scene._journal = NULL;
+    std::vector<SDFEdit> batch;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        const SDFEdit& edit = _entries[i].edit;
+        if (edit.op == SDFEdit::Add && edit.id != SDFScene::NO_ID) {
+            nextId = std::max(nextId, (uint16_t)std::min((int)edit.id + 1, (int)SDFScene::NO_ID - 1));
+        }
+        batch.push_back(edit);
+        if (batch.size() == REPLAY_BATCH_SIZE || i + 1 == _entries.size()) {
+            scene.ApplyEdits(batch);
+            batch.clear();
+        }
+    }
+    scene._journal = journal;
+
+    // ids handed out after replay follow every replayed one
+    scene._nextId = nextId;
+    return true;
+}
+
+uint64_t SDFJournal::GetNumRecorded() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _numRecorded;
+}
+
+std::vector<SDFJournal::Entry> SDFJournal::GetEntries() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries;
+}
@@ -0,0 +1,87 @@
+//
+//  sdfjournal.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFJournal_h
+#define hifi_SDFJournal_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sdfscene.h"
+
+// Append-only record of the edits applied to an SDFScene, so a scene can be rebuilt
+// after a restart and what was done to it audited.
+//
+// Each entry keeps the id its edit was applied with, so replay doesn't depend on the
+// order ids were handed out.  Replay goes through SDFScene::ApplyEdits(), which gives
+// the same result as applying edits one at a time, so the rebuilt buffers are bit
+// exact however the edits were batched or threaded when they were made.
+//
+// Every checkpointInterval edits the scene's buffers are re-baked into a lossless
+// checkpoint, see sdftilecodec.h, and the entries it covers are dropped, so replay
+// is one checkpoint decode plus at most checkpointInterval edits.
+class SDFJournal {
+public:
+    struct Entry {
+        uint64_t seq;        // edits recorded before this one since the journal began
+        uint64_t timestamp;  // microseconds since the unix epoch
+        SDFEdit edit;        // edit.id is the id it was applied with, NO_ID for a rem
+    };
+
+    // an interval of zero only checkpoints on Compact().
+    SDFJournal(uint32_t checkpointInterval = 256);
+    ~SDFJournal();
+
+    // loads filename if it exists, then appends every entry recorded from here on.
+    // A record cut short by a crash is dropped.  False if the file can't be written.
+    bool Open(const char* filename);
+    void Close();
+
+    // called by the scene after it applies edits, with the ids they were applied with.
+    // Checkpoints scene when the interval is up.
+    void Record(const SDFScene& scene, const std::vector<SDFEdit>& edits, const std::vector<uint16_t>& ids);
+
+    // checkpoints scene and drops every entry.  scene must hold what Replay() would build.
+    // Scenes with an adaptive store can't be restored from their buffers, so are refused.
+    bool Compact(const SDFScene& scene);
+
+    // rebuilds scene, which must be freshly constructed with the same flags and not yet
+    // edited.  False if the checkpoint doesn't fit the scene.
+    bool Replay(SDFScene& scene) const;
+
+    uint64_t GetNumRecorded() const;
+    std::vector<Entry> GetEntries() const;
+
+protected:
+    struct Checkpoint {
+        uint64_t seq;               // entries before seq are baked in
+        uint16_t nextId;
+        int32_t size;
+        std::vector<uint8_t> data;  // SDFTileEncoder stream of the distance and id buffers
+        std::vector<float> grad;    // gradient buffer as is, empty if the scene has none
+    };
+
+    bool CompactLocked(const SDFScene& scene);
+    bool Rewrite();
+    void WriteRecord(FILE* file, uint8_t tag, const std::vector<uint8_t>& payload);
+
+    uint32_t _checkpointInterval;
+    uint64_t _numRecorded;
+    bool _hasCheckpoint;
+    Checkpoint _checkpoint;
+    std::vector<Entry> _entries;  // since the checkpoint
+    std::string _filename;
+    FILE* _file;
+
+    // Record() runs on whatever thread applies edits, usually the SDFEditWorker's.
+    mutable std::mutex _mutex;
+};
+
+#endif
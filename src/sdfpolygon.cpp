@@ -0,0 +1,191 @@
+//
+//  sdfpolygon.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfpolygon.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+
+// unused lanes of a block hold a degenerate edge far outside the world,
+// it never crosses a ray and is never the nearest edge.
+static const float PAD_COORD = 1.0e18f;
+
+// median splits keep the tree under 32 levels for any int edge count, and the walk holds
+// at most one pending sibling per level, so this is never reached.
+static const int MAX_STACK_DEPTH = 64;
+
+// squared distance from p to the bounds of a node, zero if p is inside.
+static float box_dist2(const glm::vec2& min, const glm::vec2& max, const glm::vec2& p) {
+    glm::vec2 delta = glm::max(glm::max(min - p, p - max), glm::vec2(0.0f, 0.0f));
+    return glm::dot(delta, delta);
+}
+
+const int SDFPolygon::BLOCK_SIZE;
+
+SDFPolygon::SDFPolygon(const std::vector<glm::vec2>& points, bool closed) : _closed(closed), _numEdges(0), _points(points) {
+    std::vector<glm::vec2> a, b;
+    int numPoints = (int)points.size();
+    int numEdges = closed ? numPoints : numPoints - 1;
+    for (int i = 0; i < numEdges; i++) {
+        a.push_back(points[i]);
+        b.push_back(points[(i + 1) % numPoints]);
+    }
+    // a single point is kept as one degenerate edge, so it still has a distance.
+    if (!closed && numPoints == 1) {
+        a.push_back(points[0]);
+        b.push_back(points[0]);
+    }
+    _numEdges = (int)a.size();
+    if (_numEdges > 0) {
+        std::vector<int> edges(_numEdges);
+        for (int i = 0; i < _numEdges; i++) {
+            edges[i] = i;
+        }
+        Build(edges, 0, _numEdges, a, b);
+    }
+}
+
+void SDFPolygon::GetBounds(glm::vec2& min, glm::vec2& max) const {
+    if (_nodes.empty()) {
+        min = glm::vec2(0.0f, 0.0f);
+        max = glm::vec2(0.0f, 0.0f);
+    } else {
+        min = _nodes[0].min;
+        max = _nodes[0].max;
+    }
+}
+
+// builds the subtree over edges [begin, end), returns the index of its root node.
+int SDFPolygon::Build(std::vector<int>& edges, int begin, int end, const std::vector<glm::vec2>& a, const std::vector<glm::vec2>& b) {
+    int nodeIndex = (int)_nodes.size();
+    _nodes.push_back(Node());
+
+    Node node;
+    node.min = glm::vec2(FLT_MAX, FLT_MAX);
+    node.max = glm::vec2(-FLT_MAX, -FLT_MAX);
+    for (int i = begin; i < end; i++) {
+        node.min = glm::min(node.min, glm::min(a[edges[i]], b[edges[i]]));
+        node.max = glm::max(node.max, glm::max(a[edges[i]], b[edges[i]]));
+    }
+
+    if (end - begin <= BLOCK_SIZE) {
+        EdgeBlock block;
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            if (begin + k < end) {
+                int e = edges[begin + k];
+                glm::vec2 d = b[e] - a[e];
+                float len2 = glm::dot(d, d);
+                block.ax[k] = a[e].x;
+                block.ay[k] = a[e].y;
+                block.dx[k] = d.x;
+                block.dy[k] = d.y;
+                block.invLen2[k] = len2 > 0.0f ? 1.0f / len2 : 0.0f;
+            } else {
+                block.ax[k] = PAD_COORD;
+                block.ay[k] = PAD_COORD;
+                block.dx[k] = 0.0f;
+                block.dy[k] = 0.0f;
+                block.invLen2[k] = 0.0f;
+            }
+        }
+        node.left = -1;
+        node.right = -1;
+        node.block = (int)_blocks.size();
+        _blocks.push_back(block);
+    } else {
+        // median split along the longer axis of the bounds
+        int axis = (node.max.x - node.min.x) > (node.max.y - node.min.y) ? 0 : 1;
+        int mid = (begin + end) / 2;
+        std::nth_element(edges.begin() + begin, edges.begin() + mid, edges.begin() + end, [&](int lhs, int rhs) {
+            return (a[lhs][axis] + b[lhs][axis]) < (a[rhs][axis] + b[rhs][axis]);
+        });
+        node.block = -1;
+        node.left = Build(edges, begin, mid, a, b);
+        node.right = Build(edges, mid, end, a, b);
+    }
+
+    _nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+float SDFPolygon::Query(const glm::vec2& p, int* nearestEdge, bool* inside) const {
+    float best = FLT_MAX;
+    int bestEdge = -1;
+    int crossings = 0;
+
+    int stack[MAX_STACK_DEPTH];
+    int sp = 0;
+    if (!_nodes.empty()) {
+        stack[sp++] = 0;
+    }
+
+    while (sp > 0) {
+        const Node& node = _nodes[stack[--sp]];
+
+        // a node is only interesting if it could hold a nearer edge, or an edge crossing the ray.
+        bool near = box_dist2(node.min, node.max, p) < best;
+        bool ray = _closed && p.y >= node.min.y && p.y <= node.max.y && p.x <= node.max.x;
+        if (!near && !ray) {
+            continue;
+        }
+
+        if (node.left < 0) {
+            const EdgeBlock& block = _blocks[node.block];
+            float dist2[BLOCK_SIZE];
+            int blockCrossings = 0;
+            for (int k = 0; k < BLOCK_SIZE; k++) {
+                float pax = p.x - block.ax[k];
+                float pay = p.y - block.ay[k];
+                float h = std::min(std::max((pax * block.dx[k] + pay * block.dy[k]) * block.invLen2[k], 0.0f), 1.0f);
+                float ex = pax - block.dx[k] * h;
+                float ey = pay - block.dy[k] * h;
+                dist2[k] = ex * ex + ey * ey;
+
+                // half open test, so a ray through a shared vertex is counted once.
+                bool straddle = (block.ay[k] > p.y) != (block.ay[k] + block.dy[k] > p.y);
+                float xCross = block.ax[k] + (p.y - block.ay[k]) * block.dx[k] / block.dy[k];
+                blockCrossings += (straddle && p.x < xCross) ? 1 : 0;
+            }
+            for (int k = 0; k < BLOCK_SIZE; k++) {
+                if (dist2[k] < best) {
+                    best = dist2[k];
+                    bestEdge = node.block * BLOCK_SIZE + k;
+                }
+            }
+            crossings += blockCrossings;
+        } else {
+            assert(sp + 2 <= MAX_STACK_DEPTH);
+            // visit the nearer child first, it tightens best sooner.
+            const Node& left = _nodes[node.left];
+            const Node& right = _nodes[node.right];
+            if (box_dist2(left.min, left.max, p) < box_dist2(right.min, right.max, p)) {
+                stack[sp++] = node.right;
+                stack[sp++] = node.left;
+            } else {
+                stack[sp++] = node.left;
+                stack[sp++] = node.right;
+            }
+        }
+    }
+
+    if (nearestEdge) {
+        *nearestEdge = bestEdge;
+    }
+    if (inside) {
+        *inside = _closed && (crossings & 1);
+    }
+    return best;
+}
+
+void SDFPolygon::GetEdge(int i, glm::vec2& a, glm::vec2& d, float& invLengthSquared) const {
+    const EdgeBlock& block = _blocks[i / BLOCK_SIZE];
+    int k = i % BLOCK_SIZE;
+    a = glm::vec2(block.ax[k], block.ay[k]);
+    d = glm::vec2(block.dx[k], block.dy[k]);
+    invLengthSquared = block.invLen2[k];
+}
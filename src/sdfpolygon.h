@@ -0,0 +1,63 @@
+//
+//  sdfpolygon.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFPolygon_h
+#define hifi_SDFPolygon_h
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Edges of a polygon or polyline, arranged for fast nearest edge queries.
+// Edges are grouped into blocks of BLOCK_SIZE stored as structure of arrays, so
+// a block is evaluated as one vectorizable loop.  A bounding volume hierarchy
+// over the blocks prunes everything that can't contain the nearest edge.
+class SDFPolygon {
+public:
+    static const int BLOCK_SIZE = 8;
+
+    // points are in the local space of the prim, a closed polygon has an implicit
+    // edge from the last point back to the first.
+    SDFPolygon(const std::vector<glm::vec2>& points, bool closed);
+
+    bool IsClosed() const { return _closed; }
+    const std::vector<glm::vec2>& GetPoints() const { return _points; }
+    int GetNumEdges() const { return _numEdges; }
+
+    void GetBounds(glm::vec2& min, glm::vec2& max) const;
+
+    // returns the squared distance to the nearest edge and its index.  For closed
+    // polygons inside is set from the crossing number of a ray towards +x.
+    float Query(const glm::vec2& p, int* nearestEdge, bool* inside) const;
+
+    // start point a and direction d of edge i, the edge covers a + d * t for t in [0, 1].
+    void GetEdge(int i, glm::vec2& a, glm::vec2& d, float& invLengthSquared) const;
+
+protected:
+    struct EdgeBlock {
+        float ax[BLOCK_SIZE];
+        float ay[BLOCK_SIZE];
+        float dx[BLOCK_SIZE];
+        float dy[BLOCK_SIZE];
+        float invLen2[BLOCK_SIZE];
+    };
+
+    struct Node {
+        glm::vec2 min, max;
+        int left, right;  // child nodes, -1 for a leaf
+        int block;        // leaf only
+    };
+
+    int Build(std::vector<int>& edges, int begin, int end, const std::vector<glm::vec2>& a, const std::vector<glm::vec2>& b);
+
+    bool _closed;
+    int _numEdges;
+    std::vector<glm::vec2> _points;  // as given, so the polygon can be saved and rebuilt
+    std::vector<EdgeBlock> _blocks;
+    std::vector<Node> _nodes;
+};
+
+#endif
@@ -0,0 +1,19 @@
+//
+//  sdfprototype.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfprototype.h"
+
+SDFPrototype::SDFPrototype(const std::vector<SDFEdit>& edits, const glm::vec2& boundsMin, const glm::vec2& boundsMax,
+                           const glm::vec2& min, float spacing, int width, int height, const std::vector<float>& dist) :
+    _edits(edits), _boundsMin(boundsMin), _boundsMax(boundsMax), _min(min), _invSpacing(1.0f / spacing), _width(width), _height(height), _dist(dist) {
+    _max = min + glm::vec2((float)(width - 1), (float)(height - 1)) * spacing;
+}
+
+void SDFPrototype::GetBounds(glm::vec2& min, glm::vec2& max) const {
+    min = _boundsMin;
+    max = _boundsMax;
+}
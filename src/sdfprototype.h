@@ -0,0 +1,53 @@
+//
+//  sdfprototype.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFPrototype_h
+#define hifi_SDFPrototype_h
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sdfscene.h"
+
+// A shape built from a few edits, baked once into a tile of distances in its own local
+// space and shared by every instance of it.  An instance is sampled through its transform
+// with a bilinear fetch, so its cost no longer depends on how many edits built the shape.
+// Build with SDFScene::BakePrototype(), place with SDFEdit::MakeInstance().
+//
+// The tile covers the shape plus a margin of the smooth blend width, past its edge the
+// distance is the nearest edge sample plus the distance to the tile.
+class SDFPrototype {
+public:
+    // width x height samples, sample (i, j) is the distance at min + (i, j) * spacing.
+    // bounds are those of the shape itself, edits are kept so the prototype can be saved.
+    SDFPrototype(const std::vector<SDFEdit>& edits, const glm::vec2& boundsMin, const glm::vec2& boundsMax,
+                 const glm::vec2& min, float spacing, int width, int height, const std::vector<float>& dist);
+
+    const std::vector<SDFEdit>& GetEdits() const { return _edits; }
+
+    // bounds of the shape in local space, without the margin.
+    void GetBounds(glm::vec2& min, glm::vec2& max) const;
+
+    const glm::vec2& GetMin() const { return _min; }
+    const glm::vec2& GetMax() const { return _max; }
+    float GetInvSpacing() const { return _invSpacing; }
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+    const float* GetData() const { return _dist.data(); }
+
+    size_t GetMemorySize() const { return _dist.size() * sizeof(float); }
+
+protected:
+    std::vector<SDFEdit> _edits;
+    glm::vec2 _boundsMin, _boundsMax;
+    glm::vec2 _min, _max;
+    float _invSpacing;
+    int _width, _height;
+    std::vector<float> _dist;
+};
+
+#endif
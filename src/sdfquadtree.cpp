@@ -0,0 +1,273 @@
+//
+//  sdfquadtree.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfquadtree.h"
+
+#include <algorithm>
+#include <math.h>
+
+static float bilerp(const float* d, float u, float v) {
+    float a = d[0] + (d[1] - d[0]) * u;
+    float b = d[2] + (d[3] - d[2]) * u;
+    return a + (b - a) * v;
+}
+
+// v is the 3x3 lattice of a cell's corners, edge midpoints and center, indexed [y][x].
+// returns how far the bilinear interpolation of the corners misses the other five.
+static float lattice_error(const float v[3][3]) {
+    float e = fabsf(v[0][1] - (v[0][0] + v[0][2]) * 0.5f);
+    e = std::max(e, fabsf(v[1][0] - (v[0][0] + v[2][0]) * 0.5f));
+    e = std::max(e, fabsf(v[1][2] - (v[0][2] + v[2][2]) * 0.5f));
+    e = std::max(e, fabsf(v[2][1] - (v[2][0] + v[2][2]) * 0.5f));
+    e = std::max(e, fabsf(v[1][1] - (v[0][0] + v[0][2] + v[2][0] + v[2][2]) * 0.25f));
+    return e;
+}
+
+// when building, dist is evaluated directly.  When editing, edit is given the old
+// distance from the bilinear leaf being replaced, which covers min to min + size.
+struct SDFQuadtree::Source {
+    const DistanceFunc* dist;
+    const EditFunc* edit;
+    float old[4];
+    glm::vec2 min;
+    float size;
+
+    float Eval(const glm::vec2& p) const {
+        if (dist) {
+            return (*dist)(p);
+        }
+        glm::vec2 uv = (p - min) / size;
+        return (*edit)(p, bilerp(old, uv.x, uv.y));
+    }
+};
+
+SDFQuadtree::SDFQuadtree(const glm::vec2& min, float size, int minDepth, int maxDepth, float tolerance) :
+    _min(min), _size(size), _minDepth(minDepth), _maxDepth(std::max(minDepth, maxDepth)), _tolerance(tolerance) {
+    _nodes.resize(1);
+    for (int i = 0; i < 4; i++) {
+        _nodes[0].d[i] = 0.0f;
+    }
+    _nodes[0].children = -1;
+}
+
+void SDFQuadtree::Build(const DistanceFunc& func) {
+    _nodes.resize(1);
+    _freeBlocks.clear();
+
+    Node& root = _nodes[0];
+    root.d[0] = func(_min);
+    root.d[1] = func(_min + glm::vec2(_size, 0.0f));
+    root.d[2] = func(_min + glm::vec2(0.0f, _size));
+    root.d[3] = func(_min + glm::vec2(_size, _size));
+    root.children = -1;
+
+    Source source;
+    source.dist = &func;
+    source.edit = NULL;
+    Refine(0, _min, _size, 0, source);
+}
+
+void SDFQuadtree::Edit(const glm::vec2& min, const glm::vec2& max, const EditFunc& func) {
+    EditNode(0, _min, _size, 0, min, max, func);
+}
+
+float SDFQuadtree::Sample(const glm::vec2& p, glm::vec2* gradient) const {
+    glm::vec2 q = glm::clamp(p, _min, _min + glm::vec2(_size, _size));
+    glm::vec2 min = _min;
+    float size = _size;
+    int32_t node = 0;
+    while (_nodes[node].children >= 0) {
+        size *= 0.5f;
+        int cx = q.x >= min.x + size ? 1 : 0;
+        int cy = q.y >= min.y + size ? 1 : 0;
+        min += glm::vec2(cx * size, cy * size);
+        node = _nodes[node].children + cx + 2 * cy;
+    }
+
+    const float* d = _nodes[node].d;
+    float u = (q.x - min.x) / size;
+    float v = (q.y - min.y) / size;
+    if (gradient) {
+        gradient->x = ((d[1] - d[0]) * (1.0f - v) + (d[3] - d[2]) * v) / size;
+        gradient->y = ((d[2] - d[0]) * (1.0f - u) + (d[3] - d[1]) * u) / size;
+    }
+    return bilerp(d, u, v);
+}
+
+void SDFQuadtree::Rasterize(const SDFRect& rect, int size, const glm::vec2& origin, float spacing, float* buffer, float* gradBuffer) const {
+    if (rect.IsEmpty()) {
+        return;
+    }
+    RasterizeNode(0, _min, _size, rect, size, origin, spacing, buffer, gradBuffer);
+}
+
+int32_t SDFQuadtree::AllocBlock() {
+    if (!_freeBlocks.empty()) {
+        int32_t first = _freeBlocks.back();
+        _freeBlocks.pop_back();
+        return first;
+    }
+    int32_t first = (int32_t)_nodes.size();
+    _nodes.resize(_nodes.size() + 4);
+    return first;
+}
+
+// node is a leaf with its corners set, splits it until source is fit within the tolerance.
+// _nodes may grow, so no references are held across the recursion.
+void SDFQuadtree::Refine(int32_t node, const glm::vec2& min, float size, int depth, const Source& source) {
+    float half = size * 0.5f;
+    const float* d = _nodes[node].d;
+    float v[3][3];
+    v[0][0] = d[0];
+    v[0][2] = d[1];
+    v[2][0] = d[2];
+    v[2][2] = d[3];
+    v[0][1] = source.Eval(min + glm::vec2(half, 0.0f));
+    v[1][0] = source.Eval(min + glm::vec2(0.0f, half));
+    v[1][1] = source.Eval(min + glm::vec2(half, half));
+    v[1][2] = source.Eval(min + glm::vec2(size, half));
+    v[2][1] = source.Eval(min + glm::vec2(half, size));
+
+    if (depth >= _maxDepth || (depth >= _minDepth && lattice_error(v) <= _tolerance)) {
+        return;
+    }
+
+    // the lattice gives every corner of the children
+    int32_t first = AllocBlock();
+    _nodes[node].children = first;
+    for (int c = 0; c < 4; c++) {
+        int cx = c & 1;
+        int cy = c >> 1;
+        Node& child = _nodes[first + c];
+        child.d[0] = v[cy][cx];
+        child.d[1] = v[cy][cx + 1];
+        child.d[2] = v[cy + 1][cx];
+        child.d[3] = v[cy + 1][cx + 1];
+        child.children = -1;
+    }
+    for (int c = 0; c < 4; c++) {
+        glm::vec2 childMin = min + glm::vec2((c & 1) * half, (c >> 1) * half);
+        Refine(first + c, childMin, half, depth + 1, source);
+    }
+}
+
+void SDFQuadtree::EditNode(int32_t node, const glm::vec2& min, float size, int depth, const glm::vec2& boxMin, const glm::vec2& boxMax, const EditFunc& func) {
+    if (boxMax.x < min.x || boxMax.y < min.y || boxMin.x > min.x + size || boxMin.y > min.y + size) {
+        return;
+    }
+
+    if (_nodes[node].children < 0) {
+        // the leaf is re-fit from scratch, the old field is its own bilinear patch.
+        Source source;
+        source.dist = NULL;
+        source.edit = &func;
+        source.min = min;
+        source.size = size;
+        Node& leaf = _nodes[node];
+        for (int i = 0; i < 4; i++) {
+            source.old[i] = leaf.d[i];
+        }
+        leaf.d[0] = func(min, source.old[0]);
+        leaf.d[1] = func(min + glm::vec2(size, 0.0f), source.old[1]);
+        leaf.d[2] = func(min + glm::vec2(0.0f, size), source.old[2]);
+        leaf.d[3] = func(min + glm::vec2(size, size), source.old[3]);
+        Refine(node, min, size, depth, source);
+        return;
+    }
+
+    float half = size * 0.5f;
+    int32_t first = _nodes[node].children;
+    for (int c = 0; c < 4; c++) {
+        glm::vec2 childMin = min + glm::vec2((c & 1) * half, (c >> 1) * half);
+        EditNode(first + c, childMin, half, depth + 1, boxMin, boxMax, func);
+    }
+
+    // corner i of the node is corner i of child i
+    for (int i = 0; i < 4; i++) {
+        _nodes[node].d[i] = _nodes[first + i].d[i];
+    }
+    TryMerge(node, depth);
+}
+
+// collapses four leaf children into their parent if it reproduces them within the tolerance.
+// the difference of two bilinear fits peaks on the lattice, so checking it is exact.
+void SDFQuadtree::TryMerge(int32_t node, int depth) {
+    if (depth < _minDepth) {
+        return;
+    }
+    int32_t first = _nodes[node].children;
+    for (int c = 0; c < 4; c++) {
+        if (_nodes[first + c].children >= 0) {
+            return;
+        }
+    }
+
+    const Node* c = &_nodes[first];
+    float v[3][3];
+    v[0][0] = c[0].d[0];
+    v[0][1] = c[0].d[1];
+    v[0][2] = c[1].d[1];
+    v[1][0] = c[0].d[2];
+    v[1][1] = c[0].d[3];
+    v[1][2] = c[1].d[3];
+    v[2][0] = c[2].d[2];
+    v[2][1] = c[2].d[3];
+    v[2][2] = c[3].d[3];
+    if (lattice_error(v) > _tolerance) {
+        return;
+    }
+
+    _nodes[node].children = -1;
+    _freeBlocks.push_back(first);
+}
+
+// a node owns the texels in [min, min + nodeSize), except along the far edges of the
+// tree which are closed, so every texel is written once.
+void SDFQuadtree::RasterizeNode(int32_t node, const glm::vec2& min, float nodeSize, const SDFRect& rect, int size, const glm::vec2& origin, float spacing, float* buffer, float* gradBuffer) const {
+    float invSpacing = 1.0f / spacing;
+    glm::vec2 max = min + glm::vec2(nodeSize, nodeSize);
+    glm::vec2 treeMax = _min + glm::vec2(_size, _size);
+    int x0 = (int)ceilf((min.x - origin.x) * invSpacing);
+    int y0 = (int)ceilf((min.y - origin.y) * invSpacing);
+    int x1 = max.x < treeMax.x ? (int)ceilf((max.x - origin.x) * invSpacing) : (int)floorf((max.x - origin.x) * invSpacing) + 1;
+    int y1 = max.y < treeMax.y ? (int)ceilf((max.y - origin.y) * invSpacing) : (int)floorf((max.y - origin.y) * invSpacing) + 1;
+    SDFRect texels = SDFRect(x0, y0, x1, y1).Intersect(rect);
+    if (texels.IsEmpty()) {
+        return;
+    }
+
+    const Node& n = _nodes[node];
+    if (n.children >= 0) {
+        float half = nodeSize * 0.5f;
+        for (int c = 0; c < 4; c++) {
+            glm::vec2 childMin = min + glm::vec2((c & 1) * half, (c >> 1) * half);
+            RasterizeNode(n.children + c, childMin, half, rect, size, origin, spacing, buffer, gradBuffer);
+        }
+        return;
+    }
+
+    const float* d = n.d;
+    float invSize = 1.0f / nodeSize;
+    for (int y = texels.y0; y < texels.y1; y++) {
+        float v = (origin.y + (float)y * spacing - min.y) * invSize;
+        float a = d[0] + (d[2] - d[0]) * v;
+        float b = d[1] + (d[3] - d[1]) * v;
+        float* pixel = buffer + y * size;
+        for (int x = texels.x0; x < texels.x1; x++) {
+            float u = (origin.x + (float)x * spacing - min.x) * invSize;
+            pixel[x] = a + (b - a) * u;
+        }
+        if (gradBuffer) {
+            float* grad = gradBuffer + 2 * y * size;
+            for (int x = texels.x0; x < texels.x1; x++) {
+                float u = (origin.x + (float)x * spacing - min.x) * invSize;
+                grad[2 * x] = (b - a) * invSize;
+                grad[2 * x + 1] = ((d[2] - d[0]) * (1.0f - u) + (d[3] - d[1]) * u) * invSize;
+            }
+        }
+    }
+}
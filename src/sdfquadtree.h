@@ -0,0 +1,81 @@
+//
+//  sdfquadtree.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFQuadtree_h
+#define hifi_SDFQuadtree_h
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sdfscene.h"
+
+// Adaptively sampled distance field over a square region of the world.
+// Each leaf stores the distances at its four corners and is reconstructed bilinearly.
+// A cell is split while the bilinear reconstruction misses the field by more than the
+// tolerance at its edge midpoints or center, so flat regions stay as a few large
+// leaves and resolution goes to corners and thin features.
+//
+// Neighboring leaves of different depths are not stitched, there can be cracks up to
+// the tolerance along their shared edge.
+class SDFQuadtree {
+public:
+    typedef std::function<float (const glm::vec2& p)> DistanceFunc;
+
+    // returns the distance at p after an edit, given the distance there before it.
+    typedef std::function<float (const glm::vec2& p, float oldDist)> EditFunc;
+
+    // cells are always split down to minDepth, and never past maxDepth.
+    SDFQuadtree(const glm::vec2& min, float size, int minDepth, int maxDepth, float tolerance);
+
+    // replaces the whole tree with an approximation of func.
+    void Build(const DistanceFunc& func);
+
+    // re-samples the leaves overlapping the world space box [min, max], subdividing
+    // where the edit added detail and merging siblings it made flat again.  func must
+    // leave distances outside the box unchanged.
+    void Edit(const glm::vec2& min, const glm::vec2& max, const EditFunc& func);
+
+    // points outside the tree are clamped to its edge.
+    float Sample(const glm::vec2& p, glm::vec2* gradient = NULL) const;
+
+    // fill rect of a dense size x size buffer, texel (x, y) is at world point
+    // origin + (x, y) * spacing.  gradBuffer holds (d/dx, d/dy) per texel and may be NULL.
+    void Rasterize(const SDFRect& rect, int size, const glm::vec2& origin, float spacing, float* buffer, float* gradBuffer = NULL) const;
+
+    int GetNumNodes() const { return (int)(_nodes.size() - 4 * _freeBlocks.size()); }
+    int GetNumLeaves() const { return 1 + 3 * (GetNumNodes() - 1) / 4; }
+    size_t GetMemorySize() const { return _nodes.capacity() * sizeof(Node) + _freeBlocks.capacity() * sizeof(int32_t); }
+
+protected:
+    // corners are ordered (min.x, min.y), (max.x, min.y), (min.x, max.y), (max.x, max.y),
+    // children in the same order.
+    struct Node {
+        float d[4];
+        int32_t children;  // first of four consecutive nodes, -1 for a leaf
+    };
+
+    // distances a refinement is fitting, func evaluated over the leaf being replaced.
+    struct Source;
+
+    int32_t AllocBlock();
+    void Refine(int32_t node, const glm::vec2& min, float size, int depth, const Source& source);
+    void EditNode(int32_t node, const glm::vec2& min, float size, int depth, const glm::vec2& boxMin, const glm::vec2& boxMax, const EditFunc& func);
+    void TryMerge(int32_t node, int depth);
+    void RasterizeNode(int32_t node, const glm::vec2& min, float nodeSize, const SDFRect& rect, int size, const glm::vec2& origin, float spacing, float* buffer, float* gradBuffer) const;
+
+    glm::vec2 _min;
+    float _size;
+    int _minDepth;
+    int _maxDepth;
+    float _tolerance;
+    std::vector<Node> _nodes;  // _nodes[0] is the root
+    std::vector<int32_t> _freeBlocks;
+};
+
+#endif
@@ -9,11 +9,22 @@
 //
 
 #include "sdfscene.h"
+#include "cpupath.h"
+#include "dual.h"
+#include "sdfhistory.h"
+#include "sdfjournal.h"
+#include "sdfpolygon.h"
+#include "sdfprototype.h"
+#include "sdfquadtree.h"
+#include "sdfspatialhash.h"
 
 #include <algorithm>  // for min & max
+#include <memory>
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define _USE_MATH_DEFINES // for C++
 #include <math.h>
@@ -21,8 +32,27 @@
 static const int BUFFER_SIZE = 512;
 static const float SAMPLES_PER_METER = 128;
 static const float MAX_DISTANCE = 1.0f;
+static const float SMOOTH_K = 0.1f;
 static const float WORLD_SIZE = (float)BUFFER_SIZE / SAMPLES_PER_METER;
 
+// adaptive store, see SDFScene::AdaptiveFlag.  Leaves range from half a meter down to
+// a single texel, and are split while they miss the field by more than a quarter texel.
+static const int ADF_MIN_DEPTH = 3;
+static const int ADF_MAX_DEPTH = 9;  // WORLD_SIZE / 2^9 is one texel
+static const float ADF_TOLERANCE = 0.25f / SAMPLES_PER_METER;
+
+// dynamic layers hash their prims into cells of half MAX_DISTANCE, a prim reaches
+// MAX_DISTANCE past its bounds so a small one spans about 5x5 cells.
+static const int LAYER_CELL_TEXELS = (int)(SAMPLES_PER_METER * MAX_DISTANCE) / 2;
+static const float LAYER_CELL_SIZE = (float)LAYER_CELL_TEXELS / SAMPLES_PER_METER;
+static const int LAYER_HASH_BUCKETS = 1024;
+
+// a progressive bake starts out sampling every 8th texel, see SDFScene::ProgressiveFlag.
+static const int BAKE_START_STEP = 8;
+
+// prototype tiles reach this far past the shape, far enough for a smooth blend.
+static const float PROTOTYPE_MARGIN = SMOOTH_K + 2.0f / SAMPLES_PER_METER;
+
 static const float WORLD_TO_BUFFER_SCALE = (float)BUFFER_SIZE / (float)WORLD_SIZE;
 static glm::mat3 WORLD_TO_BUFFER_MAT(glm::vec3(WORLD_TO_BUFFER_SCALE, 0.0f, 0.0f),
                                      glm::vec3(0.0f, WORLD_TO_BUFFER_SCALE, 0.0f),
@@ -30,14 +60,22 @@ static glm::mat3 WORLD_TO_BUFFER_MAT(glm::vec3(WORLD_TO_BUFFER_SCALE, 0.0f, 0.0f
 static glm::mat3 BUFFER_TO_WORLD_MAT = glm::inverse(WORLD_TO_BUFFER_MAT);
 
 struct Prim {
-    int type; // 0 = sphere, 1 = box
+    int type; // 0 = sphere, 1 = box, 2 = polygon, 3 = polyline, 4 = instance
     float m[6];
     float inv_m[6];
-    float r[2];
+    float buf_m[6] = {}; // buffer to local space, inv_m * BUFFER_TO_WORLD_MAT
+    float r[2]; // polyline: r[0] is the half width
+    float k = SMOOTH_K; // blend width when stamped or carved
+    bool removed = false; // baked prims only, see SDFScene::RemovePrim()
+    int node = 0; // baked prims only, scene graph node, m = node world * local_m
+    float local_m[6] = {};
+    std::shared_ptr<const SDFPolygon> poly; // polygon & polyline only
+    std::shared_ptr<const SDFPrototype> proto; // instance only
 };
 
+template <typename T>
 struct MapResult {
-    float dist;
+    T dist;
     int nearest_prim;
 };
 
@@ -49,8 +87,9 @@ static float sign(float v) {
 // | m[0] m[2] m[4] |   | p[0] |   | r[0] |
 // | m[1] m[3] m[5] | * | p[1] | = | r[1] |
 // |   0    0    1  |   |   1  |   |      |
-static void xform_2x3(float *r, const float *m, float *p) {
-    float temp[2];
+template <typename T>
+static void xform_2x3(T *r, const float *m, const T *p) {
+    T temp[2];
     temp[0] = m[0] * p[0] + m[2] * p[1] + m[4];
     temp[1] = m[1] * p[0] + m[3] * p[1] + m[5];
     r[0] = temp[0];
@@ -93,118 +132,1019 @@ static void make_rotation_matrix_2x2(float *r, float theta) {
     r[3] = -r[0];
 }
 
-static float sdf_box(float *p, const Prim& prim) {
+// r = a * b, both 2x3 homogenous matrices.
+static void mul_2x3(float *r, const float *a, const float *b) {
+    float temp[6];
+    temp[0] = a[0] * b[0] + a[2] * b[1];
+    temp[1] = a[1] * b[0] + a[3] * b[1];
+    temp[2] = a[0] * b[2] + a[2] * b[3];
+    temp[3] = a[1] * b[2] + a[3] * b[3];
+    temp[4] = a[0] * b[4] + a[2] * b[5] + a[4];
+    temp[5] = a[1] * b[4] + a[3] * b[5] + a[5];
+    for (int i = 0; i < 6; i++) {
+        r[i] = temp[i];
+    }
+}
+
+// rotation by theta then translation by pos.  Unlike make_rotation_matrix_2x2 this
+// doesn't mirror y, so a node's children keep their handedness.
+static void make_transform_2x3(float *r, const glm::vec2& pos, float theta) {
+    r[0] = cosf(theta);
+    r[1] = sinf(theta);
+    r[2] = -r[1];
+    r[3] = r[0];
+    r[4] = pos.x;
+    r[5] = pos.y;
+}
+
+// The evaluators below are templated on the scalar type, T is either float
+// or Dual2.  With Dual2 the result also carries the exact gradient.
+
+template <typename T>
+static T sdf_box(const T *p, const Prim& prim) {
+    using std::fabs; using std::sqrt; using std::min; using std::max;
     // vec2 d = abs(p) - r;
     // return length(max(d, vec2(0))) + min(max(d.x, d.y), 0.0);
-    float d[2] = {fabs(p[0]) - prim.r[0], fabs(p[1]) - prim.r[1]};
-    float m[2] = {std::max(d[0], 0.0f), std::max(d[1], 0.0f)};
-    float a = sqrt(m[0] * m[0] + m[1] * m[1]);
-    float b = std::min(std::max(d[0], d[1]), 0.0f);
+    T d[2] = {fabs(p[0]) - T(prim.r[0]), fabs(p[1]) - T(prim.r[1])};
+    T m[2] = {max(d[0], T(0.0f)), max(d[1], T(0.0f))};
+    T a = sqrt(m[0] * m[0] + m[1] * m[1]);
+    T b = min(max(d[0], d[1]), T(0.0f));
     return a + b;
 }
 
-// polynomial smooth min (k = 0.1);
+// k policies, chosen once per edit so a row loop never tests k.
+
+// polynomial smooth min & max (k = 0.1);
 // https://www.iquilezles.org/www/articles/smin/smin.htm
-float smin(float a, float b, float k = 0.1f) {
-    float h = std::max(k - fabsf(a - b), 0.0f);
-    return std::min(a, b) - h * h * 0.25f / k;
+struct SmoothBlend {
+    template <typename T>
+    static T Min(T a, T b, float k) {
+        using std::fabs; using std::min; using std::max;
+        T h = max(T(k) - fabs(a - b), T(0.0f));
+        return min(a, b) - h * h * T(0.25f) / T(k);
+    }
+
+    template <typename T>
+    static T Max(T a, T b, float k) {
+        using std::fabs; using std::max;
+        T h = max(T(k) - fabs(a - b), T(0.0f));
+        return max(a, b) + h * h * T(0.25f) / T(k);
+    }
+};
+
+// k <= 0, a sharp union or subtraction.
+struct HardBlend {
+    template <typename T>
+    static T Min(T a, T b, float /*k*/) {
+        using std::min;
+        return min(a, b);
+    }
+
+    template <typename T>
+    static T Max(T a, T b, float /*k*/) {
+        using std::max;
+        return max(a, b);
+    }
+};
+
+template <typename T>
+T smin(T a, T b, float k = SMOOTH_K) {
+    return k <= 0.0f ? HardBlend::Min(a, b, k) : SmoothBlend::Min(a, b, k);
 }
 
-// https://www.iquilezles.org/www/articles/smin/smin.htm
-float smax(float a, float b, float k = 0.1f)
+template <typename T>
+T smax(T a, T b, float k = SMOOTH_K)
 {
-    float h = std::max(k - fabsf(a - b), 0.0f);
-    return std::max(a, b) + h * h * 0.25f / k;
+    return k <= 0.0f ? HardBlend::Max(a, b, k) : SmoothBlend::Max(a, b, k);
 }
 
-static float sdf_sphere(float *p, const Prim& prim) {
+// blend ops, an add unions the prim into the buffer and owns the texels where it
+// is nearer, a rem subtracts it.
+struct UnionOp {
+    static const bool SETS_ID = true;
+
+    template <typename K, typename T>
+    static T Blend(T old_dist, T prim_dist, float k) {
+        return K::Min(old_dist, prim_dist, k);
+    }
+};
+
+struct SubtractOp {
+    static const bool SETS_ID = false;
+
+    template <typename K, typename T>
+    static T Blend(T old_dist, T prim_dist, float k) {
+        return K::Max(old_dist, -prim_dist, k);
+    }
+};
+
+// the buffer holds distances clamped to [-MAX_DISTANCE, MAX_DISTANCE], this keeps
+// the texels an edit can reach within its bounds expanded by MAX_DISTANCE + k.
+template <typename T>
+static T clamp_dist(T d) {
+    using std::min; using std::max;
+    return max(T(-MAX_DISTANCE), min(T(MAX_DISTANCE), d));
+}
+
+template <typename T>
+static T sdf_sphere(const T *p, const Prim& prim) {
+    using std::sqrt;
     // return length(p) - r;
-    return sqrtf(p[0] * p[0] + p[1] * p[1]) - prim.r[0];
+    return sqrt(p[0] * p[0] + p[1] * p[1]) - T(prim.r[0]);
 }
 
-static float sdf_prim(float* p, const Prim& prim) {
-    float local_p[2];
-    switch (prim.type) {
-    default:
-    case 0:
-        xform_2x3(local_p, prim.inv_m, p);
-        return sdf_sphere(local_p, prim);
-    case 1:
-        // transform from global into local space
-        xform_2x3(local_p, prim.inv_m, p);
-        return sdf_box(local_p, prim);
+// the nearest edge is found with plain floats, only the distance to that edge
+// is evaluated with T so duals still get an exact gradient.
+template <typename T>
+static T sdf_polygon(const T *p, const Prim& prim) {
+    using std::sqrt; using std::min; using std::max;
+    int edge;
+    bool inside;
+    prim.poly->Query(glm::vec2(value_of(p[0]), value_of(p[1])), &edge, &inside);
+    if (edge < 0) {
+        return T(FLT_MAX);
+    }
+
+    // vec2 pa = p - a;
+    // float h = clamp(dot(pa, ba) / dot(ba, ba), 0.0, 1.0);
+    // return length(pa - ba * h);
+    glm::vec2 a, d;
+    float inv_len2;
+    prim.poly->GetEdge(edge, a, d, inv_len2);
+    T pa[2] = {p[0] - T(a.x), p[1] - T(a.y)};
+    T h = min(max((pa[0] * T(d.x) + pa[1] * T(d.y)) * T(inv_len2), T(0.0f)), T(1.0f));
+    T e[2] = {pa[0] - T(d.x) * h, pa[1] - T(d.y) * h};
+    T dist = sqrt(e[0] * e[0] + e[1] * e[1]);
+
+    if (prim.type == 3) {
+        return dist - T(prim.r[0]);
+    } else {
+        return inside ? -dist : dist;
     }
 }
 
+// bilinear fetch from the prototype's tile.  Outside the tile the nearest point on it is
+// sampled and the distance to it added.  Clamping with T keeps the gradient of a dual.
+template <typename T>
+static T sdf_instance(const T *p, const Prim& prim) {
+    using std::sqrt; using std::min; using std::max; using std::floor;
+    const SDFPrototype& proto = *prim.proto;
+    const glm::vec2& lo = proto.GetMin();
+    const glm::vec2& hi = proto.GetMax();
+    T q[2] = {min(max(p[0], T(lo.x)), T(hi.x)), min(max(p[1], T(lo.y)), T(hi.y))};
+    T u = (q[0] - T(lo.x)) * T(proto.GetInvSpacing());
+    T v = (q[1] - T(lo.y)) * T(proto.GetInvSpacing());
+    int w = proto.GetWidth();
+    int x = std::min((int)floor(value_of(u)), w - 2);
+    int y = std::min((int)floor(value_of(v)), proto.GetHeight() - 2);
+    T tx = u - T((float)x);
+    T ty = v - T((float)y);
+    const float* row = proto.GetData() + y * w + x;
+    T d0 = T(row[0]) + (T(row[1]) - T(row[0])) * tx;
+    T d1 = T(row[w]) + (T(row[w + 1]) - T(row[w])) * tx;
+    T dist = d0 + (d1 - d0) * ty;
+
+    T e[2] = {p[0] - q[0], p[1] - q[1]};
+    T e2 = e[0] * e[0] + e[1] * e[1];
+    if (value_of(e2) > 0.0f) {
+        dist = dist + sqrt(e2);
+    }
+    return dist;
+}
+
+// evaluators specialized on Prim::type, so code built on one knows its shape at compile time.
+static const int NUM_PRIM_TYPES = 5;
+
+template <int Type>
+struct PrimEval;
+
+template <>
+struct PrimEval<0> {
+    template <typename T>
+    static T Eval(const T* local_p, const Prim& prim) { return sdf_sphere(local_p, prim); }
+};
+
+template <>
+struct PrimEval<1> {
+    template <typename T>
+    static T Eval(const T* local_p, const Prim& prim) { return sdf_box(local_p, prim); }
+};
+
+template <>
+struct PrimEval<2> {
+    template <typename T>
+    static T Eval(const T* local_p, const Prim& prim) { return sdf_polygon(local_p, prim); }
+};
+
+template <>
+struct PrimEval<3> {
+    template <typename T>
+    static T Eval(const T* local_p, const Prim& prim) { return sdf_polygon(local_p, prim); }
+};
+
+template <>
+struct PrimEval<4> {
+    template <typename T>
+    static T Eval(const T* local_p, const Prim& prim) { return sdf_instance(local_p, prim); }
+};
+
+template <typename T>
+using PrimEvalFunc = T (*)(const T* local_p, const Prim& prim);
+
+// indexed by Prim::type
+template <typename T>
+constexpr PrimEvalFunc<T> PRIM_EVAL_FUNCS[NUM_PRIM_TYPES] = {
+    PrimEval<0>::Eval<T>, PrimEval<1>::Eval<T>, PrimEval<2>::Eval<T>, PrimEval<3>::Eval<T>, PrimEval<4>::Eval<T>
+};
+
+// evaluate a prim at a point already in its local space.
+template <typename T>
+static T sdf_prim_local(const T* local_p, const Prim& prim) {
+    return PRIM_EVAL_FUNCS<T>[prim.type](local_p, prim);
+}
+
+template <typename T>
+static T sdf_prim(const T* p, const Prim& prim) {
+    // transform from global into local space
+    T local_p[2];
+    xform_2x3(local_p, prim.inv_m, p);
+    return sdf_prim_local(local_p, prim);
+}
+
 // evaluate sdf at point p
-static MapResult map(const std::vector<Prim>& prims, float* p) {
+template <typename T>
+static MapResult<T> map(const std::vector<Prim>& prims, const T* p) {
+    using std::min;
     int nearest_prim = prims.size();
-    float dist = FLT_MAX;
+    T dist = T(FLT_MAX);
     int i;
     for (i = 0; i < (int)prims.size(); i++) {
-        float new_dist = sdf_prim(p, prims[i]);
+        if (prims[i].removed) {
+            continue;
+        }
+        T new_dist = sdf_prim(p, prims[i]);
         if (new_dist < dist) {
             nearest_prim = i;
             dist = new_dist;
         }
     }
-    MapResult result;
-    result.dist = std::min(MAX_DISTANCE, dist);
+    MapResult<T> result;
+    result.dist = clamp_dist(dist);
     result.nearest_prim = nearest_prim;
     return result;
 }
 
-static void draw_sdf_prims(const std::vector<Prim>& prims, int size, float* buffer) {
-    int x, y;
-    for (y = 0; y < size; y++) {
-        for (x = 0; x < size; x++) {
-            float *pixel = buffer + (y * size + x);
+// same as map() but only over the prims listed in indices, in increasing order, such as
+// the ones a spatial hash has near p.
+template <typename T>
+static MapResult<T> map(const std::vector<Prim>& prims, const std::vector<int>& indices, const T* p) {
+    int nearest_prim = prims.size();
+    T dist = T(FLT_MAX);
+    for (size_t j = 0; j < indices.size(); j++) {
+        int i = indices[j];
+        if (prims[i].removed) {
+            continue;
+        }
+        T new_dist = sdf_prim(p, prims[i]);
+        if (new_dist < dist) {
+            nearest_prim = i;
+            dist = new_dist;
+        }
+    }
+    MapResult<T> result;
+    result.dist = clamp_dist(dist);
+    result.nearest_prim = nearest_prim;
+    return result;
+}
+
+// helpers to move texels in and out of the distance and gradient buffers,
+// for float the gradient buffer is ignored and may be NULL.
+static void make_point(float* r, const glm::vec2& p) {
+    r[0] = p.x;
+    r[1] = p.y;
+}
+
+static void make_point(Dual2* r, const glm::vec2& p) {
+    r[0] = Dual2(p.x, 1.0f, 0.0f);
+    r[1] = Dual2(p.y, 0.0f, 1.0f);
+}
+
+static void load_texel(float& r, const float* pixel, const float*) {
+    r = *pixel;
+}
+
+static void load_texel(Dual2& r, const float* pixel, const float* grad) {
+    r = Dual2(*pixel, grad[0], grad[1]);
+}
+
+static void store_texel(float* pixel, float*, float v) {
+    *pixel = v;
+}
+
+static void store_texel(float* pixel, float* grad, const Dual2& v) {
+    *pixel = v.v;
+    grad[0] = v.d[0];
+    grad[1] = v.d[1];
+}
+
+// compose inv_m with BUFFER_TO_WORLD_MAT, call whenever m changes.
+static void update_buffer_xform(Prim& prim) {
+    const glm::mat3& b = BUFFER_TO_WORLD_MAT;
+    const float* m = prim.inv_m;
+    prim.buf_m[0] = m[0] * b[0][0] + m[2] * b[0][1];
+    prim.buf_m[1] = m[1] * b[0][0] + m[3] * b[0][1];
+    prim.buf_m[2] = m[0] * b[1][0] + m[2] * b[1][1];
+    prim.buf_m[3] = m[1] * b[1][0] + m[3] * b[1][1];
+    prim.buf_m[4] = m[0] * b[2][0] + m[2] * b[2][1] + m[4];
+    prim.buf_m[5] = m[1] * b[2][0] + m[3] * b[2][1] + m[5];
+}
+
+// local space position of the first texel in row y, a texel x further along the
+// row is at row + x * (buf_m[0], buf_m[1]).  Computing it from the row origin rather
+// than accumulating steps keeps the result independent of where a loop starts.
+static void buffer_row(float* row, const Prim& prim, int y) {
+    row[0] = prim.buf_m[2] * (float)y + prim.buf_m[4];
+    row[1] = prim.buf_m[3] * (float)y + prim.buf_m[5];
+}
+
+// the derivative of a local coordinate with respect to world space is a row of inv_m,
+// so duals built here still carry world space gradients.
+static void make_local_point(float* r, const Prim& prim, const float* row, int x) {
+    r[0] = prim.buf_m[0] * (float)x + row[0];
+    r[1] = prim.buf_m[1] * (float)x + row[1];
+}
+
+static void make_local_point(Dual2* r, const Prim& prim, const float* row, int x) {
+    r[0] = Dual2(prim.buf_m[0] * (float)x + row[0], prim.inv_m[0], prim.inv_m[2]);
+    r[1] = Dual2(prim.buf_m[1] * (float)x + row[1], prim.inv_m[1], prim.inv_m[3]);
+}
+
+// local space point of texel (x, y).  reference goes through BUFFER_TO_WORLD_MAT and
+// inv_m for every texel, the original and slower path, kept for comparison.
+template <typename T>
+static void texel_local_point(T* local_p, const Prim& prim, const float* row, int x, int y, bool reference) {
+    if (reference) {
+        // convert from "pixel" coordinates into "world" space
+        glm::vec2 bufferPoint((float)x, (float)y);
+        glm::vec2 worldPoint = BUFFER_TO_WORLD_MAT * glm::vec3(bufferPoint, 1.0f);
+        T p[2];
+        make_point(p, worldPoint);
+        xform_2x3(local_p, prim.inv_m, p);
+    } else {
+        make_local_point(local_p, prim, row, x);
+    }
+}
+
+// world space bounding box of a prim, grown by margin.
+static void prim_bounds(const Prim& prim, float margin, glm::vec2& min, glm::vec2& max) {
+    glm::vec2 center(prim.m[4], prim.m[5]);
+    glm::vec2 extent;
+    switch (prim.type) {
+    default:
+    case 0:
+        extent = glm::vec2(prim.r[0], prim.r[0]);
+        break;
+    case 1:
+        extent.x = fabsf(prim.m[0]) * prim.r[0] + fabsf(prim.m[2]) * prim.r[1];
+        extent.y = fabsf(prim.m[1]) * prim.r[0] + fabsf(prim.m[3]) * prim.r[1];
+        break;
+    case 2:
+    case 3:
+    case 4: {
+        // the polygon or prototype need not be centered on the local origin
+        glm::vec2 local_min, local_max;
+        if (prim.type == 4) {
+            prim.proto->GetBounds(local_min, local_max);
+        } else {
+            prim.poly->GetBounds(local_min, local_max);
+        }
+        float half_width = prim.type == 3 ? prim.r[0] : 0.0f;
+        float local_center[2] = {(local_min.x + local_max.x) * 0.5f, (local_min.y + local_max.y) * 0.5f};
+        float local_extent[2] = {(local_max.x - local_min.x) * 0.5f + half_width, (local_max.y - local_min.y) * 0.5f + half_width};
+        float c[2];
+        xform_2x3(c, prim.m, local_center);
+        center = glm::vec2(c[0], c[1]);
+        extent.x = fabsf(prim.m[0]) * local_extent[0] + fabsf(prim.m[2]) * local_extent[1];
+        extent.y = fabsf(prim.m[1]) * local_extent[0] + fabsf(prim.m[3]) * local_extent[1];
+        break;
+    }
+    }
+    min = center - extent - glm::vec2(margin, margin);
+    max = center + extent + glm::vec2(margin, margin);
+}
+
+// texels which an add or rem of this prim can modify.
+static SDFRect prim_edit_rect(const Prim& prim, int size) {
+    glm::vec2 min, max;
+    prim_bounds(prim, MAX_DISTANCE + std::max(prim.k, 0.0f), min, max);
+    glm::vec2 bufferMin = WORLD_TO_BUFFER_MAT * glm::vec3(min, 1.0f);
+    glm::vec2 bufferMax = WORLD_TO_BUFFER_MAT * glm::vec3(max, 1.0f);
+    SDFRect rect((int)floorf(bufferMin.x), (int)floorf(bufferMin.y), (int)ceilf(bufferMax.x) + 1, (int)ceilf(bufferMax.y) + 1);
+    return rect.Intersect(SDFRect(0, 0, size, size));
+}
+
+// float row kernels, the renderer's buffers take this path.  Each is compiled once
+// per instruction set and picked at startup, see cpupath.h.  They do the same float
+// operations in the same order as the scalar loops, so every path gives identical buffers.
 
-            // convert from "pixel" coordinates into "world" space
-            glm::vec2 bufferPoint((float)x, (float)y);
-            glm::vec2 worldPoint = BUFFER_TO_WORLD_MAT * glm::vec3(bufferPoint, 1.0f);
+// Kernels are specialized on the prim type, and edit kernels also on the blend op and
+// k policy, so each one is a single straight loop with nothing to dispatch per texel.
 
-            MapResult r = map(prims, (float*)&worldPoint);
-            float dist = r.dist;
+// distance to prim from texels [x0, x0 + n) of row y.
+template <int Type>
+CPU_FORCE_INLINE static void dist_row_kernel(const Prim& prim, int y, int x0, int n, float* __restrict out) {
+    float row[2];
+    buffer_row(row, prim, y);
+    for (int i = 0; i < n; i++) {
+        float p[2];
+        make_local_point(p, prim, row, x0 + i);
+        out[i] = PrimEval<Type>::Eval(p, prim);
+    }
+}
 
-            *pixel = dist;
+// applies prim to texels [x0, x0 + n) of row y, pixel and ids point at texel x0.
+template <int Type, typename Op, typename K>
+CPU_FORCE_INLINE static void edit_row_kernel(const Prim& prim, int y, int x0, int n, float* __restrict pixel, uint16_t* __restrict ids, uint16_t id) {
+    float row[2];
+    buffer_row(row, prim, y);
+    for (int i = 0; i < n; i++) {
+        float p[2];
+        make_local_point(p, prim, row, x0 + i);
+        float prim_dist = PrimEval<Type>::Eval(p, prim);
+        float old_dist = pixel[i];
+        if (Op::SETS_ID) {
+            ids[i] = prim_dist < old_dist ? id : ids[i];
         }
+        pixel[i] = clamp_dist(Op::template Blend<K>(old_dist, prim_dist, prim.k));
     }
 }
 
-static void add_sdf_prim(const Prim& prim, int size, float* buffer) {
+// keeps the nearest prim so far, same test as map().
+CPU_FORCE_INLINE static void min_row_kernel(float* __restrict best, int* __restrict nearest, const float* __restrict dist, int n, int prim) {
+    for (int i = 0; i < n; i++) {
+        bool closer = dist[i] < best[i];
+        nearest[i] = closer ? prim : nearest[i];
+        best[i] = closer ? dist[i] : best[i];
+    }
+}
+
+typedef void (*DistRowFunc)(const Prim& prim, int y, int x0, int n, float* out);
+typedef void (*EditRowFunc)(const Prim& prim, int y, int x0, int n, float* pixel, uint16_t* ids, uint16_t id);
+typedef void (*MinRowFunc)(float* best, int* nearest, const float* dist, int n, int prim);
+
+struct RowKernels {
+    DistRowFunc distRow[NUM_PRIM_TYPES];    // [Prim::type]
+    EditRowFunc editRow[NUM_PRIM_TYPES][2][2]; // [Prim::type][add, rem][smooth, hard]
+    MinRowFunc minRow;
+};
+
+#define ROW_KERNEL_VARIANTS(suffix, target) \
+    template <int Type> \
+    target static void dist_row_##suffix(const Prim& prim, int y, int x0, int n, float* out) { dist_row_kernel<Type>(prim, y, x0, n, out); } \
+    template <int Type, typename Op, typename K> \
+    target static void edit_row_##suffix(const Prim& prim, int y, int x0, int n, float* pixel, uint16_t* ids, uint16_t id) { edit_row_kernel<Type, Op, K>(prim, y, x0, n, pixel, ids, id); } \
+    target static void min_row_##suffix(float* best, int* nearest, const float* dist, int n, int prim) { min_row_kernel(best, nearest, dist, n, prim); }
+
+ROW_KERNEL_VARIANTS(sse2, )
+ROW_KERNEL_VARIANTS(avx2, CPU_TARGET_AVX2)
+ROW_KERNEL_VARIANTS(avx512, CPU_TARGET_AVX512)
+
+#define DIST_ROW_TABLE(suffix) \
+    { dist_row_##suffix<0>, dist_row_##suffix<1>, dist_row_##suffix<2>, dist_row_##suffix<3>, dist_row_##suffix<4> }
+#define EDIT_ROW_TABLE_ENTRY(suffix, Type) \
+    { { edit_row_##suffix<Type, UnionOp, SmoothBlend>, edit_row_##suffix<Type, UnionOp, HardBlend> }, \
+      { edit_row_##suffix<Type, SubtractOp, SmoothBlend>, edit_row_##suffix<Type, SubtractOp, HardBlend> } }
+#define EDIT_ROW_TABLE(suffix) \
+    { EDIT_ROW_TABLE_ENTRY(suffix, 0), EDIT_ROW_TABLE_ENTRY(suffix, 1), EDIT_ROW_TABLE_ENTRY(suffix, 2), EDIT_ROW_TABLE_ENTRY(suffix, 3), \
+      EDIT_ROW_TABLE_ENTRY(suffix, 4) }
+
+static constexpr RowKernels ROW_KERNELS[NumCPUPaths] = {
+    { DIST_ROW_TABLE(sse2), EDIT_ROW_TABLE(sse2), min_row_sse2 },
+    { DIST_ROW_TABLE(avx2), EDIT_ROW_TABLE(avx2), min_row_avx2 },
+    { DIST_ROW_TABLE(avx512), EDIT_ROW_TABLE(avx512), min_row_avx512 }
+};
+
+static const RowKernels& row_kernels() {
+    return ROW_KERNELS[GetCPUPath()];
+}
+
+// bakes the texels of rect from every prim not removed, every step texels.  Texels on the
+// skip grid, sampled by a coarser level already, are left alone.
+template <typename T>
+static void draw_sdf_prims(const std::vector<Prim>& prims, const SDFRect& rect, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference, int step = 1, int skip = 0) {
+    std::vector<float> rows(2 * prims.size());
     int x, y;
-    for (y = 0; y < size; y++) {
-        for (x = 0; x < size; x++) {
+    for (y = rect.y0; y < rect.y1; y += step) {
+        for (size_t i = 0; i < prims.size(); i++) {
+            buffer_row(&rows[2 * i], prims[i], y);
+        }
+        for (x = rect.x0; x < rect.x1; x += step) {
+            if (skip && x % skip == 0 && y % skip == 0) {
+                continue;
+            }
             float *pixel = buffer + (y * size + x);
+            float *grad = grad_buffer ? grad_buffer + 2 * (y * size + x) : NULL;
+            uint16_t *id = id_buffer + (y * size + x);
 
-            // convert from "pixel" coordinates into "world" space
-            glm::vec2 bufferPoint((float)x, (float)y);
-            glm::vec2 worldPoint = BUFFER_TO_WORLD_MAT * glm::vec3(bufferPoint, 1.0f);
+            // same as map(), but each prim is evaluated from its buffer space transform
+            int nearest_prim = (int)prims.size();
+            T dist = T(FLT_MAX);
+            for (size_t i = 0; i < prims.size(); i++) {
+                if (prims[i].removed) {
+                    continue;
+                }
+                T local_p[2];
+                texel_local_point(local_p, prims[i], &rows[2 * i], x, y, reference);
+                T new_dist = sdf_prim_local(local_p, prims[i]);
+                if (new_dist < dist) {
+                    nearest_prim = (int)i;
+                    dist = new_dist;
+                }
+            }
 
-            *pixel = smin(*pixel, sdf_prim((float*)&worldPoint, prim));
+            store_texel(pixel, grad, clamp_dist(dist));
+            *id = nearest_prim < (int)SDFScene::NO_ID ? (uint16_t)nearest_prim : SDFScene::NO_ID;
         }
     }
 }
 
-static void rem_sdf_prim(const Prim& prim, int size, float* buffer) {
+// fills the texels between the samples draw_sdf_prims() took every step texels, distances
+// and gradients bilinearly, ids from the nearest sample.  Past the last sample of a row or
+// column the last one is repeated.
+static void upsample_sdf(int step, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer) {
+    int last = (size - 1) / step * step;
+    for (int y = 0; y < size; y++) {
+        int y0 = std::min(y / step * step, last);
+        int y1 = std::min(y0 + step, last);
+        float ty = y1 > y0 ? (float)(y - y0) / (float)step : 0.0f;
+        int ny = std::min((y + step / 2) / step * step, last);
+        for (int x = 0; x < size; x++) {
+            if (x % step == 0 && y % step == 0) {
+                continue;
+            }
+            int x0 = std::min(x / step * step, last);
+            int x1 = std::min(x0 + step, last);
+            float tx = x1 > x0 ? (float)(x - x0) / (float)step : 0.0f;
+            int nx = std::min((x + step / 2) / step * step, last);
+            int i00 = y0 * size + x0, i10 = y0 * size + x1, i01 = y1 * size + x0, i11 = y1 * size + x1;
+            float w00 = (1.0f - tx) * (1.0f - ty), w10 = tx * (1.0f - ty), w01 = (1.0f - tx) * ty, w11 = tx * ty;
+            int i = y * size + x;
+            buffer[i] = buffer[i00] * w00 + buffer[i10] * w10 + buffer[i01] * w01 + buffer[i11] * w11;
+            if (grad_buffer) {
+                for (int c = 0; c < 2; c++) {
+                    grad_buffer[2 * i + c] = grad_buffer[2 * i00 + c] * w00 + grad_buffer[2 * i10 + c] * w10 +
+                        grad_buffer[2 * i01 + c] * w01 + grad_buffer[2 * i11 + c] * w11;
+                }
+            }
+            id_buffer[i] = id_buffer[ny * size + nx];
+        }
+    }
+}
+
+// float bake built from the row kernels, same result as draw_sdf_prims<float>.
+static void draw_sdf_rows(const std::vector<Prim>& prims, const SDFRect& rect, int size, float* buffer, uint16_t* id_buffer) {
+    const RowKernels& kernels = row_kernels();
+    int width = rect.x1 - rect.x0;
+    std::vector<float> dist(width), best(width);
+    std::vector<int> nearest(width);
     int x, y;
-    for (y = 0; y < size; y++) {
-        for (x = 0; x < size; x++) {
-            float *pixel = buffer + (y * size + x);
+    for (y = rect.y0; y < rect.y1; y++) {
+        std::fill(best.begin(), best.end(), FLT_MAX);
+        std::fill(nearest.begin(), nearest.end(), (int)prims.size());
+        for (size_t i = 0; i < prims.size(); i++) {
+            if (prims[i].removed) {
+                continue;
+            }
+            kernels.distRow[prims[i].type](prims[i], y, rect.x0, width, dist.data());
+            kernels.minRow(best.data(), nearest.data(), dist.data(), width, (int)i);
+        }
+        for (x = 0; x < width; x++) {
+            buffer[y * size + rect.x0 + x] = clamp_dist(best[x]);
+            id_buffer[y * size + rect.x0 + x] = nearest[x] < (int)SDFScene::NO_ID ? (uint16_t)nearest[x] : SDFScene::NO_ID;
+        }
+    }
+}
+
+// one entry of a fused batch.
+struct PrimEdit {
+    Prim prim;
+    bool add;
+    uint16_t id;
+    SDFRect rect;
+};
+
+static const int BATCH_TILE_SIZE = 32;
+
+// texels [x0, x1) of row y, one texel at a time.
+template <typename T>
+static void scalar_edit_row(const PrimEdit& edit, int y, int x0, int x1, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference) {
+    float row[2];
+    buffer_row(row, edit.prim, y);
+    for (int x = x0; x < x1; x++) {
+        float *pixel = buffer + (y * size + x);
+        float *grad = grad_buffer ? grad_buffer + 2 * (y * size + x) : NULL;
+
+        T local_p[2], old_dist;
+        texel_local_point(local_p, edit.prim, row, x, y, reference);
+        load_texel(old_dist, pixel, grad);
+        T prim_dist = sdf_prim_local(local_p, edit.prim);
+        if (edit.add) {
+            if (prim_dist < old_dist) {
+                id_buffer[y * size + x] = edit.id;
+            }
+            store_texel(pixel, grad, clamp_dist(smin(old_dist, prim_dist, edit.prim.k)));
+        } else {
+            store_texel(pixel, grad, clamp_dist(smax(old_dist, -prim_dist, edit.prim.k)));
+        }
+    }
+}
+
+template <typename T>
+static void apply_edit_row(const PrimEdit& edit, int y, int x0, int x1, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference) {
+    scalar_edit_row<T>(edit, y, x0, x1, size, buffer, grad_buffer, id_buffer, reference);
+}
+
+// float rows go through the row kernel specialized for this edit.
+template <>
+void apply_edit_row<float>(const PrimEdit& edit, int y, int x0, int x1, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference) {
+    if (reference) {
+        scalar_edit_row<float>(edit, y, x0, x1, size, buffer, grad_buffer, id_buffer, reference);
+        return;
+    }
+    EditRowFunc editRow = row_kernels().editRow[edit.prim.type][edit.add ? 0 : 1][edit.prim.k > 0.0f ? 0 : 1];
+    editRow(edit.prim, y, x0, x1 - x0, buffer + y * size + x0, id_buffer + y * size + x0, edit.id);
+}
+
+// applies a batch of edits in one pass.  The union of their rects is walked in tiles
+// small enough to stay in cache, and each tile runs every edit that reaches it before
+// moving on, so the buffer is streamed through memory once rather than once per edit.
+// Each texel still sees the edits in batch order, so the result matches applying them
+// one at a time.
+template <typename T>
+static void apply_sdf_prims_tile(const std::vector<PrimEdit>& edits, const SDFRect& tile, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference) {
+    for (size_t i = 0; i < edits.size(); i++) {
+        const PrimEdit& edit = edits[i];
+        SDFRect rect = edit.rect.Intersect(tile);
+        for (int y = rect.y0; y < rect.y1; y++) {
+            apply_edit_row<T>(edit, y, rect.x0, rect.x1, size, buffer, grad_buffer, id_buffer, reference);
+        }
+    }
+}
+
+// tile index of a pass over bounds, in row order.
+static SDFRect batch_tile(const SDFRect& bounds, int index) {
+    int tilesPerRow = (bounds.x1 - bounds.x0 + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+    int tx = bounds.x0 + (index % tilesPerRow) * BATCH_TILE_SIZE;
+    int ty = bounds.y0 + (index / tilesPerRow) * BATCH_TILE_SIZE;
+    return SDFRect(tx, ty, std::min(tx + BATCH_TILE_SIZE, bounds.x1), std::min(ty + BATCH_TILE_SIZE, bounds.y1));
+}
+
+static int num_batch_tiles(const SDFRect& bounds) {
+    if (bounds.IsEmpty()) {
+        return 0;
+    }
+    int tilesPerRow = (bounds.x1 - bounds.x0 + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+    int tilesPerColumn = (bounds.y1 - bounds.y0 + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+    return tilesPerRow * tilesPerColumn;
+}
+
+template <typename T>
+static void apply_sdf_prims(const std::vector<PrimEdit>& edits, const SDFRect& bounds, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, bool reference) {
+    int numTiles = num_batch_tiles(bounds);
+    for (int i = 0; i < numTiles; i++) {
+        apply_sdf_prims_tile<T>(edits, batch_tile(bounds, i), size, buffer, grad_buffer, id_buffer, reference);
+    }
+}
+
+// a batch of edits being applied a few tiles at a time, see SDFScene::BeginEdits().
+struct SDFEditPass {
+    std::vector<SDFEdit> edits;     // kept for the journal
+    std::vector<uint16_t> ids;
+    std::vector<PrimEdit> primEdits;
+    SDFRect bounds;
+    int nextTile;
+    int numTiles;
+};
+
+// dense copy of rect from the adaptive store.
+static void rasterize_adf(const SDFQuadtree& tree, const SDFRect& rect, int size, float* buffer, float* grad_buffer) {
+    glm::vec2 origin = BUFFER_TO_WORLD_MAT * glm::vec3(0.0f, 0.0f, 1.0f);
+    tree.Rasterize(rect, size, origin, 1.0f / WORLD_TO_BUFFER_SCALE, buffer, grad_buffer);
+}
+
+// edits the adaptive store, then refreshes the dense copy.  Edits go one at a time, ids
+// use the same test as the row kernels, against the distances before each edit.
+static void apply_adf_edits(SDFQuadtree& tree, const std::vector<PrimEdit>& edits, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer) {
+    const RowKernels& kernels = row_kernels();
+    std::vector<float> dist(size);
+    for (size_t i = 0; i < edits.size(); i++) {
+        const PrimEdit& edit = edits[i];
+        const Prim& prim = edit.prim;
+        if (edit.rect.IsEmpty()) {
+            continue;
+        }
+
+        if (edit.add) {
+            int n = edit.rect.x1 - edit.rect.x0;
+            for (int y = edit.rect.y0; y < edit.rect.y1; y++) {
+                kernels.distRow[prim.type](prim, y, edit.rect.x0, n, dist.data());
+                int offset = y * size + edit.rect.x0;
+                for (int x = 0; x < n; x++) {
+                    id_buffer[offset + x] = dist[x] < buffer[offset + x] ? edit.id : id_buffer[offset + x];
+                }
+            }
+        }
+
+        glm::vec2 min, max;
+        prim_bounds(prim, MAX_DISTANCE + std::max(prim.k, 0.0f), min, max);
+        bool add = edit.add;
+        tree.Edit(min, max, [&prim, add](const glm::vec2& pos, float old_dist) {
+            float p[2];
+            make_point(p, pos);
+            float prim_dist = sdf_prim(p, prim);
+            return clamp_dist(add ? smin(old_dist, prim_dist, prim.k) : smax(old_dist, -prim_dist, prim.k));
+        });
+        rasterize_adf(tree, edit.rect, size, buffer, grad_buffer);
+    }
+}
+
+// a dynamic layer, see SDFScene::AddLayer().  The buffers hold the distance to the nearest
+// of the layer's prims, unclamped so a smooth blend outside a prim's edit rect still leaves
+// the layers below untouched, and that prim's id.  Texels no prim reaches hold FLT_MAX.
+//
+// The prims' edit rects are kept in a spatial hash with cells of LAYER_CELL_SIZE, so when
+// a few of many prims move only the cells they left or entered are re-evaluated, and only
+// against the prims in those cells.  edits are the prims as last set, to find the changed ones.
+struct SDFLayer {
+    SDFLayer() : hash(glm::vec2(-WORLD_SIZE / 2.0f, -WORLD_SIZE / 2.0f), LAYER_CELL_SIZE, LAYER_HASH_BUCKETS) {}
+
+    SDFScene::LayerOp op;
+    float k;
+    std::vector<SDFEdit> edits;
+    std::vector<Prim> prims;
+    std::vector<uint16_t> primIds;
+    std::vector<SDFRect> primRects;
+    std::vector<int> handles;  // in hash, per prim
+    std::vector<float> buffer;
+    std::vector<uint16_t> ids;
+    SDFRect rect;  // union of primRects
+    SDFSpatialHash hash;
+
+    // scratch, kept so setting the prims every frame doesn't allocate.
+    std::vector<uint8_t> dirty;  // per cell
+    std::vector<int> dirtyCells;
+    std::vector<int> candidates;
+    std::vector<float> dist;
+    std::vector<int> nearest;  // per texel of a cell
+};
+
+// world space box of the texels in rect, the texel centers on its edges included.  Texels
+// and cells line up, so the box covers the cells of those texels.
+static void layer_rect_bounds(const SDFRect& rect, glm::vec2& min, glm::vec2& max) {
+    min = glm::vec2(BUFFER_TO_WORLD_MAT * glm::vec3((float)rect.x0, (float)rect.y0, 1.0f));
+    max = glm::vec2(BUFFER_TO_WORLD_MAT * glm::vec3((float)(rect.x1 - 1), (float)(rect.y1 - 1), 1.0f));
+}
+
+static void mark_layer_cells(SDFLayer& layer, const SDFRect& rect) {
+    if (rect.IsEmpty()) {
+        return;
+    }
+    int cellsPerRow = (BUFFER_SIZE + LAYER_CELL_TEXELS - 1) / LAYER_CELL_TEXELS;
+    for (int cy = rect.y0 / LAYER_CELL_TEXELS; cy <= (rect.y1 - 1) / LAYER_CELL_TEXELS; cy++) {
+        for (int cx = rect.x0 / LAYER_CELL_TEXELS; cx <= (rect.x1 - 1) / LAYER_CELL_TEXELS; cx++) {
+            int cell = cy * cellsPerRow + cx;
+            if (!layer.dirty[cell]) {
+                layer.dirty[cell] = 1;
+                layer.dirtyCells.push_back(cell);
+            }
+        }
+    }
+}
+
+// re-evaluates the texels of one cell against the prims the hash has in it.  Same kernels
+// and the same prim order as drawing every prim over the layer, so the result is identical.
+static void draw_layer_cell(SDFLayer& layer, int cx, int cy, int size) {
+    const RowKernels& kernels = row_kernels();
+    SDFRect cellRect(cx * LAYER_CELL_TEXELS, cy * LAYER_CELL_TEXELS, (cx + 1) * LAYER_CELL_TEXELS, (cy + 1) * LAYER_CELL_TEXELS);
+    cellRect = cellRect.Intersect(SDFRect(0, 0, size, size));
+    int width = cellRect.x1 - cellRect.x0;
+    for (int y = cellRect.y0; y < cellRect.y1; y++) {
+        float* best = &layer.buffer[y * size + cellRect.x0];
+        std::fill(best, best + width, FLT_MAX);
+    }
+    std::fill(layer.nearest.begin(), layer.nearest.end(), -1);
+
+    layer.hash.QueryCell(cx, cy, layer.candidates);
+    // ties go to the lower index, as in map()
+    std::sort(layer.candidates.begin(), layer.candidates.end());
+    for (size_t j = 0; j < layer.candidates.size(); j++) {
+        int i = layer.candidates[j];
+        SDFRect primRect = layer.primRects[i].Intersect(cellRect);
+        int n = primRect.x1 - primRect.x0;
+        for (int y = primRect.y0; y < primRect.y1; y++) {
+            int offset = (y - cellRect.y0) * LAYER_CELL_TEXELS + primRect.x0 - cellRect.x0;
+            kernels.distRow[layer.prims[i].type](layer.prims[i], y, primRect.x0, n, layer.dist.data());
+            kernels.minRow(&layer.buffer[y * size + primRect.x0], layer.nearest.data() + offset, layer.dist.data(), n, i);
+        }
+    }
+
+    for (int y = cellRect.y0; y < cellRect.y1; y++) {
+        const int* nearest = layer.nearest.data() + (y - cellRect.y0) * LAYER_CELL_TEXELS;
+        uint16_t* ids = &layer.ids[y * size + cellRect.x0];
+        for (int x = 0; x < width; x++) {
+            ids[x] = nearest[x] < 0 ? SDFScene::NO_ID : layer.primIds[nearest[x]];
+        }
+    }
+}
+
+// blends n texels of a layer into dist and ids, the same test and blend as an edit.
+template <typename Op, typename K>
+static void composite_layer_row(float* dist, uint16_t* ids, const float* layer_dist, const uint16_t* layer_ids, int n, float k) {
+    for (int i = 0; i < n; i++) {
+        float d = layer_dist[i];
+        if (Op::SETS_ID) {
+            ids[i] = d < dist[i] ? layer_ids[i] : ids[i];
+        }
+        dist[i] = clamp_dist(Op::template Blend<K>(dist[i], d, k));
+    }
+}
+
+// per texel, the baked prims within MAX_DISTANCE, nearest first, see SDFScene::NearestCacheFlag.
+// Ties keep the lower index first, as map() does.  While complete is set every prim within
+// MAX_DISTANCE is cached, otherwise the entries are still the nearest ones but there are more.
+struct SDFNearestCache {
+    static const int K = SDFScene::NEAREST_CACHE_SIZE;
+
+    std::vector<float> dist;      // K per texel
+    std::vector<uint16_t> prims;  // K per texel
+    std::vector<uint8_t> counts;
+    std::vector<uint8_t> complete;
+};
+
+// distance to prim from texels [x0, x0 + n) of row y, the same value the bake computes.
+static void prim_dist_row(const Prim& prim, int y, int x0, int n, float* out, bool reference) {
+    if (!reference) {
+        row_kernels().distRow[prim.type](prim, y, x0, n, out);
+        return;
+    }
+    float row[2];
+    buffer_row(row, prim, y);
+    for (int i = 0; i < n; i++) {
+        float local_p[2];
+        texel_local_point(local_p, prim, row, x0 + i, y, reference);
+        out[i] = sdf_prim_local(local_p, prim);
+    }
+}
+
+static void cache_insert(SDFNearestCache& cache, int texel, float dist, uint16_t prim) {
+    const int K = SDFNearestCache::K;
+    if (!(dist < MAX_DISTANCE)) {
+        return;
+    }
+    float* d = &cache.dist[texel * K];
+    uint16_t* p = &cache.prims[texel * K];
+    int n = cache.counts[texel];
+    bool last = n == 0 || dist > d[n - 1] || (dist == d[n - 1] && prim > p[n - 1]);
+    if (!cache.complete[texel] && last) {
+        // prims that aren't cached may come first
+        return;
+    }
+    if (n == K) {
+        // full, the farthest entry or the new one falls off
+        cache.complete[texel] = 0;
+        if (last) {
+            return;
+        }
+        n--;
+    }
+    int i = n;
+    while (i > 0 && (dist < d[i - 1] || (dist == d[i - 1] && prim < p[i - 1]))) {
+        d[i] = d[i - 1];
+        p[i] = p[i - 1];
+        i--;
+    }
+    d[i] = dist;
+    p[i] = prim;
+    cache.counts[texel] = (uint8_t)(n + 1);
+}
+
+static void cache_remove(SDFNearestCache& cache, int texel, uint16_t prim) {
+    const int K = SDFNearestCache::K;
+    float* d = &cache.dist[texel * K];
+    uint16_t* p = &cache.prims[texel * K];
+    int n = cache.counts[texel];
+    for (int i = 0; i < n; i++) {
+        if (p[i] == prim) {
+            for (int j = i + 1; j < n; j++) {
+                d[j - 1] = d[j];
+                p[j - 1] = p[j];
+            }
+            cache.counts[texel] = (uint8_t)(n - 1);
+            return;
+        }
+    }
+}
 
-            // convert from "pixel" coordinates into "world" space
-            glm::vec2 bufferPoint((float)x, (float)y);
-            glm::vec2 worldPoint = BUFFER_TO_WORLD_MAT * glm::vec3(bufferPoint, 1.0f);
+static void build_nearest_cache(const std::vector<Prim>& prims, int size, SDFNearestCache& cache, bool reference) {
+    const int K = SDFNearestCache::K;
+    cache.dist.assign(size * size * K, 0.0f);
+    cache.prims.assign(size * size * K, 0);
+    cache.counts.assign(size * size, 0);
+    cache.complete.assign(size * size, 1);
+    std::vector<float> dist(size);
+    for (int y = 0; y < size; y++) {
+        for (size_t i = 0; i < prims.size(); i++) {
+            if (prims[i].removed) {
+                continue;
+            }
+            prim_dist_row(prims[i], y, 0, size, dist.data(), reference);
+            for (int x = 0; x < size; x++) {
+                cache_insert(cache, y * size + x, dist[x], (uint16_t)i);
+            }
+        }
+    }
+}
 
-            *pixel = smax(*pixel, -sdf_prim((float*)&worldPoint, prim));
+// rewrites texel (x, y) from the nearest cached prim.  Where the cache has run out, or
+// nothing is within MAX_DISTANCE and the texel's id is a changed prim, every prim is
+// evaluated and the cache refilled.  changed is indexed by prim.
+static void resolve_nearest(const std::vector<Prim>& prims, SDFNearestCache& cache, int x, int y, int size, float* buffer, float* grad_buffer, uint16_t* id_buffer, const std::vector<uint8_t>& changed, bool reference) {
+    int texel = y * size + x;
+    int nearest = -1;
+    float dist = MAX_DISTANCE;
+    if (cache.counts[texel] > 0) {
+        nearest = cache.prims[texel * SDFNearestCache::K];
+        dist = cache.dist[texel * SDFNearestCache::K];
+    } else if (!cache.complete[texel] || (id_buffer[texel] < changed.size() && changed[id_buffer[texel]])) {
+        // same as map(), out here the nearest prim can be beyond MAX_DISTANCE
+        cache.complete[texel] = 1;
+        nearest = (int)prims.size();
+        dist = FLT_MAX;
+        for (size_t i = 0; i < prims.size(); i++) {
+            if (prims[i].removed) {
+                continue;
+            }
+            float d;
+            prim_dist_row(prims[i], y, x, 1, &d, reference);
+            if (d < dist) {
+                nearest = (int)i;
+                dist = d;
+            }
+            cache_insert(cache, texel, d, (uint16_t)i);
+        }
+        id_buffer[texel] = nearest < (int)SDFScene::NO_ID ? (uint16_t)nearest : SDFScene::NO_ID;
+        if (nearest == (int)prims.size()) {
+            nearest = -1;
         }
     }
+
+    if (nearest >= 0 && nearest < (int)prims.size()) {
+        id_buffer[texel] = (uint16_t)nearest;
+    }
+    if (grad_buffer && nearest >= 0) {
+        const Prim& prim = prims[nearest];
+        float row[2];
+        buffer_row(row, prim, y);
+        Dual2 local_p[2];
+        texel_local_point(local_p, prim, row, x, y, reference);
+        store_texel(buffer + texel, grad_buffer + 2 * texel, clamp_dist(sdf_prim_local(local_p, prim)));
+    } else if (grad_buffer) {
+        store_texel(buffer + texel, grad_buffer + 2 * texel, Dual2(clamp_dist(dist), 0.0f, 0.0f));
+    } else {
+        buffer[texel] = clamp_dist(dist);
+    }
 }
 
-SDFScene::SDFScene() {
+// a scene graph node, see SDFScene::AddNode().  world_m, min and max are cached, dirty
+// means local_m changed since the last SDFScene::UpdateNodes(), and boundsDirty that
+// something in the subtree did, so the bounds are stale and the walk has to come this way.
+struct SDFNode {
+    int parent;
+    float local_m[6];
+    float world_m[6];
+    std::vector<int> children;
+    std::vector<int> prims;
+    glm::vec2 min, max;  // world space bounds of the subtree's prims, empty if min > max
+    bool dirty;
+    bool boundsDirty;
+};
+
+const uint16_t SDFScene::NO_ID;
+
+SDFScene::SDFScene(unsigned int flags) {
     _size = BUFFER_SIZE;
     _buffer = new float[_size * _size];
+    _gradBuffer = (flags & GradientFlag) ? new float[2 * _size * _size] : NULL;
+    _idBuffer = new uint16_t[_size * _size];
+    _quadtree = NULL;
+    _nearestCache = NULL;
+    _editPass = NULL;
+    _editing = false;
+    _bakeStep = 1;
+    _journal = NULL;
+    _history = NULL;
+    _referenceEval = (flags & ReferenceEvalFlag) != 0;
+    _dirtyRect = SDFRect(0, 0, _size, _size);
 
     // ground
     Prim prim;
@@ -327,7 +1267,53 @@ SDFScene::SDFScene() {
     prim.r[0] = 0.09f;
     _prims.push_back(prim);
 
-    draw_sdf_prims(_prims, _size, _buffer);
+    for (size_t i = 0; i < _prims.size(); i++) {
+        update_buffer_xform(_prims[i]);
+        memcpy(_prims[i].local_m, _prims[i].m, sizeof(_prims[i].m));
+    }
+
+    // the root holds every prim not in a prefab
+    AddNode(-1, glm::vec2(0.0f, 0.0f), 0.0f);
+    for (size_t i = 0; i < _prims.size(); i++) {
+        _nodes[0]->prims.push_back((int)i);
+    }
+
+    // prefabs, prims 3 to 8 are the house, 9 to 11 the tree
+    int house = AddNode(0, glm::vec2(0.6f, 0.4f), 0.0f);
+    for (int i = 3; i <= 8; i++) {
+        SetPrimNode(i, house);
+    }
+    int tree = AddNode(0, glm::vec2(0.15f, 0.3f), 0.0f);
+    for (int i = 9; i <= 11; i++) {
+        SetPrimNode(i, tree);
+    }
+    UpdateNodes();
+
+    if ((flags & ProgressiveFlag) && !(flags & AdaptiveFlag)) {
+        _bakeStep = BAKE_START_STEP;
+        DrawPrims(SDFRect(0, 0, _size, _size), _bakeStep);
+    } else {
+        DrawPrims(SDFRect(0, 0, _size, _size));
+    }
+
+    // the adaptive store can't be fixed up texel by texel.  A progressive bake builds the
+    // cache once it is done, see RefineBake().
+    if ((flags & NearestCacheFlag) && !(flags & AdaptiveFlag)) {
+        _nearestCache = new SDFNearestCache();
+        if (_bakeStep == 1) {
+            build_nearest_cache(_prims, _size, *_nearestCache, _referenceEval);
+        }
+    }
+
+    // ids of stamped prims follow the baked ones
+    _nextId = (uint16_t)std::min((int)_prims.size(), (int)NO_ID);
+
+    // the ids above still come from the dense bake
+    if (flags & AdaptiveFlag) {
+        _quadtree = new SDFQuadtree(BufferToWorld(glm::vec2(0.0f, 0.0f)), WORLD_SIZE, ADF_MIN_DEPTH, ADF_MAX_DEPTH, ADF_TOLERANCE);
+        _quadtree->Build([this](const glm::vec2& pos) { return EvalDistance(pos); });
+        rasterize_adf(*_quadtree, SDFRect(0, 0, _size, _size), _size, _buffer, _gradBuffer);
+    }
 
     // AJT: TEST CODE REMOVE
 
@@ -356,30 +1342,809 @@ SDFScene::SDFScene() {
 SDFScene::~SDFScene() {
     // TODO: use a unique_ptr
     delete [] _buffer;
+    delete [] _gradBuffer;
+    delete [] _idBuffer;
+    delete _quadtree;
+    delete _nearestCache;
+    delete _editPass;
+    for (size_t i = 0; i < _layers.size(); i++) {
+        delete _layers[i];
+    }
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        delete _nodes[i];
+    }
 }
 
-void SDFScene::AddCircle(const glm::vec2& pos, float radius) {
-    Prim prim;
-    prim.type = 0;
-    make_rotation_matrix_2x2(prim.m, 0.0f);
-    prim.m[4] = pos.x;
-    prim.m[5] = pos.y;
+uint16_t SDFScene::AllocId() {
+    // once the 16-bit id space is exhausted all later prims share the last id.
+    uint16_t id = _nextId.load();
+    while (id < NO_ID - 1 && !_nextId.compare_exchange_weak(id, (uint16_t)(id + 1))) {
+    }
+    return id;
+}
+
+SDFEdit SDFEdit::MakeCircle(Op op, const glm::vec2& pos, float radius) {
+    SDFEdit edit;
+    edit.op = op;
+    edit.type = Circle;
+    edit.pos = pos;
+    edit.angle = 0.0f;
+    edit.r = glm::vec2(radius, radius);
+    edit.k = SMOOTH_K;
+    edit.id = SDFScene::NO_ID;
+    return edit;
+}
+
+SDFEdit SDFEdit::MakeBox(Op op, const glm::vec2& pos, float angle, const glm::vec2& halfExtents) {
+    SDFEdit edit;
+    edit.op = op;
+    edit.type = Box;
+    edit.pos = pos;
+    edit.angle = angle;
+    edit.r = halfExtents;
+    edit.k = SMOOTH_K;
+    edit.id = SDFScene::NO_ID;
+    return edit;
+}
+
+// polygon and polyline points are given in world space, so they get an identity transform.
+SDFEdit SDFEdit::MakePolygon(Op op, const std::vector<glm::vec2>& points) {
+    SDFEdit edit;
+    edit.op = op;
+    edit.type = Polygon;
+    edit.pos = glm::vec2(0.0f, 0.0f);
+    edit.angle = 0.0f;
+    edit.r = glm::vec2(0.0f, 0.0f);
+    edit.k = SMOOTH_K;
+    edit.id = SDFScene::NO_ID;
+    edit.poly = std::make_shared<SDFPolygon>(points, true);
+    return edit;
+}
+
+SDFEdit SDFEdit::MakePolyline(Op op, const std::vector<glm::vec2>& points, float halfWidth) {
+    SDFEdit edit;
+    edit.op = op;
+    edit.type = Polyline;
+    edit.pos = glm::vec2(0.0f, 0.0f);
+    edit.angle = 0.0f;
+    edit.r = glm::vec2(halfWidth, halfWidth);
+    edit.k = SMOOTH_K;
+    edit.id = SDFScene::NO_ID;
+    edit.poly = std::make_shared<SDFPolygon>(points, false);
+    return edit;
+}
+
+SDFEdit SDFEdit::MakeInstance(Op op, const std::shared_ptr<const SDFPrototype>& proto, const glm::vec2& pos, float angle) {
+    SDFEdit edit;
+    edit.op = op;
+    edit.type = Instance;
+    edit.pos = pos;
+    edit.angle = angle;
+    edit.r = glm::vec2(0.0f, 0.0f);
+    edit.k = SMOOTH_K;
+    edit.id = SDFScene::NO_ID;
+    edit.proto = proto;
+    return edit;
+}
+
+bool SDFEdit::Covers(const SDFEdit& earlier) const {
+    // only hard blended circles are considered.  When earlier lies inside this circle this
+    // one is the nearer everywhere, so min(min(old, earlier), this) == min(old, this) and
+    // the same for max.  A smooth blend of the two would move the surface, so those stay.
+    if (op != earlier.op || type != Circle || earlier.type != Circle || k > 0.0f || earlier.k > 0.0f) {
+        return false;
+    }
+    // strictly inside, so rounding can't make the two tie and hand the texel to earlier's id
+    return glm::distance(pos, earlier.pos) + earlier.r.x < r.x;
+}
+
+static void make_prim(Prim& prim, const SDFEdit& edit) {
+    prim.type = edit.type;
+    if (edit.type == SDFEdit::Polygon || edit.type == SDFEdit::Polyline) {
+        prim.m[0] = 1.0f; prim.m[1] = 0.0f;
+        prim.m[2] = 0.0f; prim.m[3] = 1.0f;
+    } else if (edit.type == SDFEdit::Instance) {
+        // an instance must not be mirrored
+        make_transform_2x3(prim.m, edit.pos, edit.angle);
+    } else {
+        make_rotation_matrix_2x2(prim.m, edit.angle);
+    }
+    prim.m[4] = edit.pos.x;
+    prim.m[5] = edit.pos.y;
     orthonormal_invert_2x3(prim.inv_m, prim.m);
-    prim.r[0] = radius;
+    update_buffer_xform(prim);
+    prim.r[0] = edit.r.x;
+    prim.r[1] = edit.r.y;
+    prim.k = edit.k;
+    prim.poly = edit.poly;
+    prim.proto = edit.proto;
+}
 
-    add_sdf_prim(prim, _size, _buffer);
+uint16_t SDFScene::ApplyEdit(const SDFEdit& edit) {
+    Prim prim;
+    make_prim(prim, edit);
+    uint16_t id = NO_ID;
+    if (edit.op == SDFEdit::Add) {
+        id = StampPrim(prim, edit.id);
+    } else {
+        CarvePrim(prim);
+    }
+    if (_journal) {
+        _journal->Record(*this, std::vector<SDFEdit>(1, edit), std::vector<uint16_t>(1, id));
+    }
+    return id;
+}
+
+void SDFScene::ApplyEdits(const std::vector<SDFEdit>& edits, std::vector<uint16_t>* ids) {
+    BeginEdits(edits, ids);
+    while (!StepEdits(INT_MAX)) {
+    }
+}
+
+void SDFScene::BeginEdits(const std::vector<SDFEdit>& edits, std::vector<uint16_t>* ids) {
+    if (!_editPass) {
+        _editPass = new SDFEditPass();
+    }
+    SDFEditPass& pass = *_editPass;
+    pass.edits = edits;
+    pass.ids.clear();
+    pass.primEdits.resize(edits.size());
+    pass.bounds = SDFRect();
+    for (size_t i = 0; i < edits.size(); i++) {
+        PrimEdit& primEdit = pass.primEdits[i];
+        make_prim(primEdit.prim, edits[i]);
+        primEdit.add = edits[i].op == SDFEdit::Add;
+        primEdit.id = NO_ID;
+        if (primEdit.add) {
+            primEdit.id = edits[i].id == NO_ID ? AllocId() : edits[i].id;
+        }
+        primEdit.rect = prim_edit_rect(primEdit.prim, _size);
+        pass.bounds = pass.bounds.Union(primEdit.rect);
+        pass.ids.push_back(primEdit.id);
+    }
+    if (ids) {
+        *ids = pass.ids;
+    }
+    if (!pass.bounds.IsEmpty()) {
+        KeepBakeEdits(pass.primEdits);
+    }
+    if (_history && !pass.bounds.IsEmpty()) {
+        for (size_t i = 0; i < pass.primEdits.size(); i++) {
+            _history->Capture(*this, pass.primEdits[i].rect);
+        }
+    }
+    pass.nextTile = 0;
+    // the adaptive store is edited as a whole, in the first step
+    pass.numTiles = _quadtree ? (pass.bounds.IsEmpty() ? 0 : 1) : num_batch_tiles(pass.bounds);
+    _editing = true;
+}
+
+bool SDFScene::StepEdits(int maxTiles) {
+    if (!_editing) {
+        return true;
+    }
+    SDFEditPass& pass = *_editPass;
+    int end = pass.numTiles - pass.nextTile > maxTiles ? pass.nextTile + maxTiles : pass.numTiles;
+    for (; pass.nextTile < end; pass.nextTile++) {
+        if (_quadtree) {
+            apply_adf_edits(*_quadtree, pass.primEdits, _size, _buffer, _gradBuffer, _idBuffer);
+            _dirtyRect = _dirtyRect.Union(pass.bounds);
+            continue;
+        }
+        SDFRect tile = batch_tile(pass.bounds, pass.nextTile);
+        if (_gradBuffer) {
+            apply_sdf_prims_tile<Dual2>(pass.primEdits, tile, _size, _buffer, _gradBuffer, _idBuffer, _referenceEval);
+        } else {
+            apply_sdf_prims_tile<float>(pass.primEdits, tile, _size, _buffer, NULL, _idBuffer, _referenceEval);
+        }
+        _dirtyRect = _dirtyRect.Union(tile);
+    }
+    if (pass.nextTile < pass.numTiles) {
+        return false;
+    }
+
+    // journal checkpoints save the buffer, so the batch is recorded once it is all applied
+    if (_journal) {
+        _journal->Record(*this, pass.edits, pass.ids);
+    }
+    pass.edits.clear();
+    pass.primEdits.clear();
+    _editing = false;
+    return true;
+}
+
+uint16_t SDFScene::AddCircle(const glm::vec2& pos, float radius) {
+    return ApplyEdit(SDFEdit::MakeCircle(SDFEdit::Add, pos, radius));
 }
 
 void SDFScene::RemCircle(const glm::vec2& pos, float radius) {
-    Prim prim;
-    prim.type = 0;
-    make_rotation_matrix_2x2(prim.m, 0.0f);
+    ApplyEdit(SDFEdit::MakeCircle(SDFEdit::Rem, pos, radius));
+}
+
+uint16_t SDFScene::AddPolygon(const std::vector<glm::vec2>& points) {
+    return ApplyEdit(SDFEdit::MakePolygon(SDFEdit::Add, points));
+}
+
+void SDFScene::RemPolygon(const std::vector<glm::vec2>& points) {
+    ApplyEdit(SDFEdit::MakePolygon(SDFEdit::Rem, points));
+}
+
+uint16_t SDFScene::AddPolyline(const std::vector<glm::vec2>& points, float halfWidth, uint16_t id) {
+    SDFEdit edit = SDFEdit::MakePolyline(SDFEdit::Add, points, halfWidth);
+    edit.id = id;
+    return ApplyEdit(edit);
+}
+
+void SDFScene::RemPolyline(const std::vector<glm::vec2>& points, float halfWidth) {
+    ApplyEdit(SDFEdit::MakePolyline(SDFEdit::Rem, points, halfWidth));
+}
+
+uint16_t SDFScene::StampPrim(const Prim& prim, uint16_t id) {
+    std::vector<PrimEdit> primEdits(1);
+    primEdits[0].prim = prim;
+    primEdits[0].add = true;
+    primEdits[0].id = id == NO_ID ? AllocId() : id;
+    primEdits[0].rect = prim_edit_rect(prim, _size);
+    ApplyPrimEdits(primEdits, primEdits[0].rect);
+    return primEdits[0].id;
+}
+
+void SDFScene::CarvePrim(const Prim& prim) {
+    std::vector<PrimEdit> primEdits(1);
+    primEdits[0].prim = prim;
+    primEdits[0].add = false;
+    primEdits[0].id = NO_ID;
+    primEdits[0].rect = prim_edit_rect(prim, _size);
+    ApplyPrimEdits(primEdits, primEdits[0].rect);
+}
+
+void SDFScene::ApplyPrimEdits(const std::vector<PrimEdit>& primEdits, const SDFRect& bounds) {
+    if (bounds.IsEmpty()) {
+        return;
+    }
+    KeepBakeEdits(primEdits);
+    if (_history) {
+        for (size_t i = 0; i < primEdits.size(); i++) {
+            _history->Capture(*this, primEdits[i].rect);
+        }
+    }
+    if (_quadtree) {
+        apply_adf_edits(*_quadtree, primEdits, _size, _buffer, _gradBuffer, _idBuffer);
+    } else if (_gradBuffer) {
+        apply_sdf_prims<Dual2>(primEdits, bounds, _size, _buffer, _gradBuffer, _idBuffer, _referenceEval);
+    } else {
+        apply_sdf_prims<float>(primEdits, bounds, _size, _buffer, NULL, _idBuffer, _referenceEval);
+    }
+    _dirtyRect = _dirtyRect.Union(bounds);
+}
+
+std::shared_ptr<const SDFPrototype> SDFScene::BakePrototype(const std::vector<SDFEdit>& edits) {
+    std::vector<Prim> prims(edits.size());
+    glm::vec2 boundsMin(FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX);
+    for (size_t i = 0; i < edits.size(); i++) {
+        make_prim(prims[i], edits[i]);
+        if (edits[i].op == SDFEdit::Add) {
+            glm::vec2 min, max;
+            prim_bounds(prims[i], 0.0f, min, max);
+            boundsMin = glm::min(boundsMin, min);
+            boundsMax = glm::max(boundsMax, max);
+        }
+    }
+    if (boundsMin.x > boundsMax.x) {
+        boundsMin = boundsMax = glm::vec2(0.0f, 0.0f);
+    }
+
+    // samples as far apart as the scene's texels
+    float spacing = 1.0f / SAMPLES_PER_METER;
+    glm::vec2 min = boundsMin - glm::vec2(PROTOTYPE_MARGIN, PROTOTYPE_MARGIN);
+    glm::vec2 max = boundsMax + glm::vec2(PROTOTYPE_MARGIN, PROTOTYPE_MARGIN);
+    int width = std::max((int)ceilf((max.x - min.x) / spacing) + 1, 2);
+    int height = std::max((int)ceilf((max.y - min.y) / spacing) + 1, 2);
+
+    // the same as stamping the edits in order into empty space
+    std::vector<float> dist(width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float p[2] = {min.x + (float)x * spacing, min.y + (float)y * spacing};
+            float d = MAX_DISTANCE;
+            for (size_t i = 0; i < prims.size(); i++) {
+                float prim_dist = sdf_prim(p, prims[i]);
+                d = clamp_dist(edits[i].op == SDFEdit::Add ? smin(d, prim_dist, prims[i].k) : smax(d, -prim_dist, prims[i].k));
+            }
+            dist[y * width + x] = d;
+        }
+    }
+    return std::make_shared<SDFPrototype>(edits, boundsMin, boundsMax, min, spacing, width, height, dist);
+}
+
+int SDFScene::GetNumPrims() const {
+    return (int)_prims.size();
+}
+
+bool SDFScene::RemovePrim(int index) {
+    if (index < 0 || index >= (int)_prims.size() || _prims[index].removed) {
+        return false;
+    }
+    // texels are fixed up from the prims, the bake must see them as they were
+    FinishBake();
+    std::vector<int> indices(1, index);
+    std::vector<SDFRect> oldRects(1, prim_edit_rect(_prims[index], _size));
+    _prims[index].removed = true;
+    MarkBoundsDirty(_prims[index].node);
+    UpdatePrims(indices, oldRects);
+    return true;
+}
+
+bool SDFScene::MovePrim(int index, const glm::vec2& pos, float angle) {
+    if (index < 0 || index >= (int)_prims.size() || _prims[index].removed) {
+        return false;
+    }
+    FinishBake();
+    Prim& prim = _prims[index];
+    std::vector<int> indices(1, index);
+    std::vector<SDFRect> oldRects(1, prim_edit_rect(prim, _size));
+    make_rotation_matrix_2x2(prim.m, angle);
     prim.m[4] = pos.x;
     prim.m[5] = pos.y;
     orthonormal_invert_2x3(prim.inv_m, prim.m);
-    prim.r[0] = radius;
+    update_buffer_xform(prim);
+
+    // keep it where it was put when its node moves
+    float inv_world[6];
+    orthonormal_invert_2x3(inv_world, _nodes[prim.node]->world_m);
+    mul_2x3(prim.local_m, inv_world, prim.m);
+    MarkBoundsDirty(prim.node);
+    UpdatePrims(indices, oldRects);
+    return true;
+}
+
+int SDFScene::AddNode(int parent, const glm::vec2& pos, float angle) {
+    SDFNode* node = new SDFNode();
+    node->parent = parent;
+    make_transform_2x3(node->local_m, pos, angle);
+    if (parent >= 0) {
+        mul_2x3(node->world_m, _nodes[parent]->world_m, node->local_m);
+        _nodes[parent]->children.push_back((int)_nodes.size());
+    } else {
+        memcpy(node->world_m, node->local_m, sizeof(node->world_m));
+    }
+    node->min = glm::vec2(FLT_MAX, FLT_MAX);
+    node->max = glm::vec2(-FLT_MAX, -FLT_MAX);
+    node->dirty = false;
+    node->boundsDirty = false;
+    _nodes.push_back(node);
+    return (int)_nodes.size() - 1;
+}
+
+int SDFScene::GetNumNodes() const {
+    return (int)_nodes.size();
+}
+
+bool SDFScene::SetPrimNode(int index, int node) {
+    if (index < 0 || index >= (int)_prims.size() || node < 0 || node >= (int)_nodes.size()) {
+        return false;
+    }
+    Prim& prim = _prims[index];
+    std::vector<int>& oldPrims = _nodes[prim.node]->prims;
+    oldPrims.erase(std::remove(oldPrims.begin(), oldPrims.end(), index), oldPrims.end());
+    MarkBoundsDirty(prim.node);
+
+    float inv_world[6];
+    orthonormal_invert_2x3(inv_world, _nodes[node]->world_m);
+    mul_2x3(prim.local_m, inv_world, prim.m);
+    prim.node = node;
+    _nodes[node]->prims.push_back(index);
+    MarkBoundsDirty(node);
+    return true;
+}
+
+bool SDFScene::SetNodeTransform(int node, const glm::vec2& pos, float angle) {
+    if (node <= 0 || node >= (int)_nodes.size()) {
+        return false;
+    }
+    make_transform_2x3(_nodes[node]->local_m, pos, angle);
+    _nodes[node]->dirty = true;
+    MarkBoundsDirty(node);
+    return true;
+}
+
+bool SDFScene::GetNodeBounds(int node, glm::vec2& min, glm::vec2& max) const {
+    if (node < 0 || node >= (int)_nodes.size() || _nodes[node]->min.x > _nodes[node]->max.x) {
+        return false;
+    }
+    min = _nodes[node]->min;
+    max = _nodes[node]->max;
+    return true;
+}
+
+void SDFScene::UpdateNodes() {
+    if (_nodes.empty() || !_nodes[0]->boundsDirty) {
+        return;
+    }
+    FinishBake();
+    std::vector<int> indices;
+    std::vector<SDFRect> oldRects;
+    UpdateNode(0, false, indices, oldRects);
+    UpdatePrims(indices, oldRects);
+}
+
+void SDFScene::MarkBoundsDirty(int node) {
+    // stops at the first node already marked, its ancestors are too
+    while (node >= 0 && !_nodes[node]->boundsDirty) {
+        _nodes[node]->boundsDirty = true;
+        node = _nodes[node]->parent;
+    }
+}
+
+// walks the dirty part of the subtree at node.  Moved prims get new transforms and are
+// added to indices along with the rect they reached before, bounds are recomputed on the
+// way back up.
+void SDFScene::UpdateNode(int index, bool parentMoved, std::vector<int>& indices, std::vector<SDFRect>& oldRects) {
+    SDFNode& node = *_nodes[index];
+    if (!node.boundsDirty && !parentMoved) {
+        return;
+    }
+    bool moved = parentMoved || node.dirty;
+    if (moved && node.parent >= 0) {
+        mul_2x3(node.world_m, _nodes[node.parent]->world_m, node.local_m);
+    }
+
+    node.min = glm::vec2(FLT_MAX, FLT_MAX);
+    node.max = glm::vec2(-FLT_MAX, -FLT_MAX);
+    for (size_t i = 0; i < node.prims.size(); i++) {
+        Prim& prim = _prims[node.prims[i]];
+        if (prim.removed) {
+            continue;
+        }
+        if (moved) {
+            indices.push_back(node.prims[i]);
+            oldRects.push_back(prim_edit_rect(prim, _size));
+            mul_2x3(prim.m, node.world_m, prim.local_m);
+            orthonormal_invert_2x3(prim.inv_m, prim.m);
+            update_buffer_xform(prim);
+        }
+        glm::vec2 min, max;
+        prim_bounds(prim, 0.0f, min, max);
+        node.min = glm::min(node.min, min);
+        node.max = glm::max(node.max, max);
+    }
+    for (size_t i = 0; i < node.children.size(); i++) {
+        UpdateNode(node.children[i], moved, indices, oldRects);
+        const SDFNode& child = *_nodes[node.children[i]];
+        node.min = glm::min(node.min, child.min);
+        node.max = glm::max(node.max, child.max);
+    }
+    node.dirty = false;
+    node.boundsDirty = false;
+}
+
+// fixes up the texels the prims in indices reached before, oldRects, and reach now.
+// The nearest cache only needs the changed prims, without it the texels are re-baked.  The
+// callers finish the bake before they change the prims, so it and the cache match them.
+void SDFScene::UpdatePrims(const std::vector<int>& indices, const std::vector<SDFRect>& oldRects) {
+    if (_quadtree || indices.empty()) {
+        return;
+    }
+    std::vector<SDFRect> newRects(indices.size());
+    std::vector<uint8_t> changed(_prims.size(), 0);
+    SDFRect region;
+    for (size_t i = 0; i < indices.size(); i++) {
+        const Prim& prim = _prims[indices[i]];
+        newRects[i] = prim.removed ? SDFRect() : prim_edit_rect(prim, _size);
+        region = region.Union(oldRects[i]).Union(newRects[i]);
+        changed[indices[i]] = 1;
+    }
+    if (region.IsEmpty()) {
+        return;
+    }
+    if (_history) {
+        _history->Capture(*this, region);
+    }
+    _dirtyRect = _dirtyRect.Union(region);
+    if (!_nearestCache) {
+        DrawPrims(region);
+        return;
+    }
+
+    std::vector<float> dist(indices.size() * _size);
+    for (int y = region.y0; y < region.y1; y++) {
+        for (size_t i = 0; i < indices.size(); i++) {
+            const SDFRect& rect = newRects[i];
+            if (y >= rect.y0 && y < rect.y1) {
+                prim_dist_row(_prims[indices[i]], y, rect.x0, rect.x1 - rect.x0, &dist[i * _size], _referenceEval);
+            }
+        }
+        for (int x = region.x0; x < region.x1; x++) {
+            int texel = y * _size + x;
+            for (size_t i = 0; i < indices.size(); i++) {
+                cache_remove(*_nearestCache, texel, (uint16_t)indices[i]);
+            }
+            for (size_t i = 0; i < indices.size(); i++) {
+                const SDFRect& rect = newRects[i];
+                if (y >= rect.y0 && y < rect.y1 && x >= rect.x0 && x < rect.x1) {
+                    cache_insert(*_nearestCache, texel, dist[i * _size + x - rect.x0], (uint16_t)indices[i]);
+                }
+            }
+            resolve_nearest(_prims, *_nearestCache, x, y, _size, _buffer, _gradBuffer, _idBuffer, changed, _referenceEval);
+        }
+    }
+}
+
+void SDFScene::BeginBake() {
+    SDFRect rect(0, 0, _size, _size);
+    _bakeEdits.clear();
+    _dirtyRect = rect;
+    if (_quadtree) {
+        // the adaptive store is built in one go, the ids still come from the dense bake
+        DrawPrims(rect);
+        _quadtree->Build([this](const glm::vec2& pos) { return EvalDistance(pos); });
+        rasterize_adf(*_quadtree, rect, _size, _buffer, _gradBuffer);
+        _bakeStep = 1;
+        return;
+    }
+    _bakeStep = BAKE_START_STEP;
+    DrawPrims(rect, _bakeStep);
+}
+
+bool SDFScene::RefineBake() {
+    if (_bakeStep == 1) {
+        return true;
+    }
+    int coarse = _bakeStep;
+    _bakeStep /= 2;
+    SDFRect rect(0, 0, _size, _size);
+    SDFRect bounds;
+    for (size_t i = 0; i < _bakeEdits.size(); i++) {
+        bounds = bounds.Union(_bakeEdits[i].rect);
+    }
+
+    // only the samples this level adds are baked, the coarser ones are kept, except where
+    // the edits went over them, they are applied again below.
+    DrawSamples(rect, _bakeStep, coarse);
+    if (!bounds.IsEmpty()) {
+        SDFRect aligned(bounds.x0 / coarse * coarse, bounds.y0 / coarse * coarse, bounds.x1, bounds.y1);
+        DrawSamples(aligned, coarse, 0);
+    }
+    if (_bakeStep > 1) {
+        upsample_sdf(_bakeStep, _size, _buffer, _gradBuffer, _idBuffer);
+    }
+
+    if (!_bakeEdits.empty()) {
+        std::vector<PrimEdit> edits;
+        edits.swap(_bakeEdits);
+        if (_gradBuffer) {
+            apply_sdf_prims<Dual2>(edits, bounds, _size, _buffer, _gradBuffer, _idBuffer, _referenceEval);
+        } else {
+            apply_sdf_prims<float>(edits, bounds, _size, _buffer, NULL, _idBuffer, _referenceEval);
+        }
+        if (_bakeStep > 1) {
+            edits.swap(_bakeEdits);
+        }
+    }
+    _dirtyRect = rect;
+    if (_bakeStep == 1 && _nearestCache && _nearestCache->counts.empty()) {
+        build_nearest_cache(_prims, _size, *_nearestCache, _referenceEval);
+    }
+    return _bakeStep == 1;
+}
+
+void SDFScene::FinishBake() {
+    while (!RefineBake()) {
+    }
+}
+
+void SDFScene::SkipBake() {
+    _bakeEdits.clear();
+    if (_nearestCache && _nearestCache->counts.empty()) {
+        build_nearest_cache(_prims, _size, *_nearestCache, _referenceEval);
+    }
+    _bakeStep = 1;
+}
+
+// edits applied while a progressive bake is under way are kept for the finer levels, or
+// the bake is finished first if they also go to a history or journal, which must only
+// ever see the final buffer.
+void SDFScene::KeepBakeEdits(const std::vector<PrimEdit>& primEdits) {
+    if (_bakeStep == 1) {
+        return;
+    }
+    if (_history || _journal) {
+        FinishBake();
+        return;
+    }
+    _bakeEdits.insert(_bakeEdits.end(), primEdits.begin(), primEdits.end());
+}
+
+void SDFScene::DrawPrims(const SDFRect& rect, int step) {
+    if (step > 1) {
+        // only the full buffer is drawn coarse
+        DrawSamples(rect, step, 0);
+        upsample_sdf(step, _size, _buffer, _gradBuffer, _idBuffer);
+        return;
+    }
+    if (_gradBuffer) {
+        draw_sdf_prims<Dual2>(_prims, rect, _size, _buffer, _gradBuffer, _idBuffer, _referenceEval);
+    } else if (_referenceEval) {
+        draw_sdf_prims<float>(_prims, rect, _size, _buffer, NULL, _idBuffer, _referenceEval);
+    } else {
+        draw_sdf_rows(_prims, rect, _size, _buffer, _idBuffer);
+    }
+}
+
+// bakes every step texels of rect but those on the skip grid.  The samples line up with
+// texel 0, so rect must start on the step grid.
+void SDFScene::DrawSamples(const SDFRect& rect, int step, int skip) {
+    if (_gradBuffer) {
+        draw_sdf_prims<Dual2>(_prims, rect, _size, _buffer, _gradBuffer, _idBuffer, _referenceEval, step, skip);
+    } else if (step > 1 || _referenceEval) {
+        draw_sdf_prims<float>(_prims, rect, _size, _buffer, NULL, _idBuffer, _referenceEval, step, skip);
+    } else {
+        // rows off the skip grid are new in full and go through the row kernels
+        for (int y = rect.y0; y < rect.y1; y++) {
+            SDFRect row(rect.x0, y, rect.x1, y + 1);
+            if (skip && y % skip == 0) {
+                draw_sdf_prims<float>(_prims, row, _size, _buffer, NULL, _idBuffer, false, 1, skip);
+            } else {
+                draw_sdf_rows(_prims, row, _size, _buffer, _idBuffer);
+            }
+        }
+    }
+}
+
+int SDFScene::AddLayer(LayerOp op, float k) {
+    SDFLayer* layer = new SDFLayer();
+    layer->op = op;
+    layer->k = k;
+    layer->buffer.resize(_size * _size, FLT_MAX);
+    layer->ids.resize(_size * _size, NO_ID);
+    int cellsPerRow = (_size + LAYER_CELL_TEXELS - 1) / LAYER_CELL_TEXELS;
+    layer->dirty.resize(cellsPerRow * cellsPerRow, 0);
+    layer->dirtyCells.reserve(cellsPerRow * cellsPerRow);
+    layer->dist.resize(LAYER_CELL_TEXELS);
+    layer->nearest.resize(LAYER_CELL_TEXELS * LAYER_CELL_TEXELS);
+    _layers.push_back(layer);
+    return (int)_layers.size() - 1;
+}
+
+// true if a and b make the same layer prim, the op is ignored.
+static bool same_layer_prim(const SDFEdit& a, const SDFEdit& b) {
+    return a.type == b.type && a.pos == b.pos && a.angle == b.angle && a.r == b.r && a.id == b.id &&
+        a.poly == b.poly && a.proto == b.proto;
+}
+
+void SDFScene::SetLayerPrims(int layerIndex, const std::vector<SDFEdit>& prims) {
+    SDFLayer& layer = *_layers[layerIndex];
+    SDFRect oldRect = layer.rect;
+    size_t oldCount = layer.prims.size();
+    size_t count = prims.size();
+
+    // prims past the new count leave the hash, the others are inserted or moved if they changed.
+    for (size_t i = count; i < oldCount; i++) {
+        mark_layer_cells(layer, layer.primRects[i]);
+        layer.hash.Remove(layer.handles[i]);
+    }
+    layer.edits.resize(count);
+    layer.prims.resize(count);
+    layer.primIds.resize(count);
+    layer.primRects.resize(count);
+    layer.handles.resize(count, -1);
+    layer.rect = SDFRect();
+    for (size_t i = 0; i < count; i++) {
+        bool added = i >= oldCount;
+        if (added || !same_layer_prim(layer.edits[i], prims[i])) {
+            if (!added) {
+                mark_layer_cells(layer, layer.primRects[i]);
+            }
+            layer.edits[i] = prims[i];
+            make_prim(layer.prims[i], prims[i]);
+            layer.primIds[i] = prims[i].id;
+            // the layer's blend width decides how far a prim reaches, not the edit's
+            layer.prims[i].k = layer.k;
+            layer.primRects[i] = prim_edit_rect(layer.prims[i], _size);
+            mark_layer_cells(layer, layer.primRects[i]);
+
+            // the texels drawn for the prim, and the points EvalLayerDistance() must find it
+            // from, which go past the buffer.
+            glm::vec2 min, max;
+            prim_bounds(layer.prims[i], MAX_DISTANCE + std::max(layer.k, 0.0f), min, max);
+            if (!layer.primRects[i].IsEmpty()) {
+                glm::vec2 rectMin, rectMax;
+                layer_rect_bounds(layer.primRects[i], rectMin, rectMax);
+                min = glm::min(min, rectMin);
+                max = glm::max(max, rectMax);
+            }
+            if (added) {
+                layer.handles[i] = layer.hash.Insert(min, max, (int)i);
+            } else {
+                layer.hash.Move(layer.handles[i], min, max);
+            }
+        }
+        layer.rect = layer.rect.Union(layer.primRects[i]);
+    }
+
+    int cellsPerRow = (_size + LAYER_CELL_TEXELS - 1) / LAYER_CELL_TEXELS;
+    for (size_t i = 0; i < layer.dirtyCells.size(); i++) {
+        int cell = layer.dirtyCells[i];
+        draw_layer_cell(layer, cell % cellsPerRow, cell / cellsPerRow, _size);
+        layer.dirty[cell] = 0;
+    }
+    layer.dirtyCells.clear();
+    _dirtyRect = _dirtyRect.Union(oldRect).Union(layer.rect);
+}
+
+float SDFScene::EvalLayerDistance(int layerIndex, const glm::vec2& pos, glm::vec2* gradient) const {
+    // callers may be on other threads, so don't touch the layer's scratch.
+    const SDFLayer& layer = *_layers[layerIndex];
+    std::vector<int> candidates;
+    layer.hash.Query(pos, candidates);
+    std::sort(candidates.begin(), candidates.end());
+    if (gradient) {
+        Dual2 p[2];
+        make_point(p, pos);
+        MapResult<Dual2> r = map(layer.prims, candidates, p);
+        gradient->x = r.dist.d[0];
+        gradient->y = r.dist.d[1];
+        return r.dist.v;
+    } else {
+        float p[2];
+        make_point(p, pos);
+        return map(layer.prims, candidates, p).dist;
+    }
+}
+
+void SDFScene::CompositeRow(int y, int x0, int n, float* dist, uint16_t* ids) const {
+    int offset = y * _size;
+    memcpy(dist, _buffer + offset + x0, n * sizeof(float));
+    memcpy(ids, _idBuffer + offset + x0, n * sizeof(uint16_t));
+    for (size_t i = 0; i < _layers.size(); i++) {
+        const SDFLayer& layer = *_layers[i];
+        int x1 = std::min(x0 + n, layer.rect.x1);
+        int begin = std::max(x0, layer.rect.x0);
+        if (y < layer.rect.y0 || y >= layer.rect.y1 || begin >= x1) {
+            continue;
+        }
+        const float* layerDist = &layer.buffer[offset + begin];
+        const uint16_t* layerIds = &layer.ids[offset + begin];
+        float* d = dist + (begin - x0);
+        uint16_t* id = ids + (begin - x0);
+        bool smooth = layer.k > 0.0f;
+        if (layer.op == UnionLayer) {
+            if (smooth) {
+                composite_layer_row<UnionOp, SmoothBlend>(d, id, layerDist, layerIds, x1 - begin, layer.k);
+            } else {
+                composite_layer_row<UnionOp, HardBlend>(d, id, layerDist, layerIds, x1 - begin, layer.k);
+            }
+        } else {
+            if (smooth) {
+                composite_layer_row<SubtractOp, SmoothBlend>(d, id, layerDist, layerIds, x1 - begin, layer.k);
+            } else {
+                composite_layer_row<SubtractOp, HardBlend>(d, id, layerDist, layerIds, x1 - begin, layer.k);
+            }
+        }
+    }
+}
+
+float SDFScene::EvalDistance(const glm::vec2& pos, glm::vec2* gradient) const {
+    if (gradient) {
+        Dual2 p[2];
+        make_point(p, pos);
+        MapResult<Dual2> r = map(_prims, p);
+        gradient->x = r.dist.d[0];
+        gradient->y = r.dist.d[1];
+        return r.dist.v;
+    } else {
+        float p[2];
+        make_point(p, pos);
+        return map(_prims, p).dist;
+    }
+}
+
+glm::vec2 SDFScene::BufferToWorld(const glm::vec2& bufferPoint) const {
+    return BUFFER_TO_WORLD_MAT * glm::vec3(bufferPoint, 1.0f);
+}
 
-    rem_sdf_prim(prim, _size, _buffer);
+glm::vec2 SDFScene::WorldToBuffer(const glm::vec2& worldPoint) const {
+    return WORLD_TO_BUFFER_MAT * glm::vec3(worldPoint, 1.0f);
 }
 
 int SDFScene::GetSamplesPerMeter() const {
@@ -11,27 +11,289 @@
 #ifndef hifi_SDFScene_h
 #define hifi_SDFScene_h
 
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <glm/glm.hpp>
 
 struct Prim;
+struct PrimEdit;
+struct SDFEdit;
+struct SDFEditPass;
+struct SDFLayer;
+struct SDFNearestCache;
+struct SDFNode;
+class SDFHistory;
+class SDFJournal;
+class SDFPolygon;
+class SDFPrototype;
+class SDFQuadtree;
+
+// half open rectangle of texels, [x0, x1) x [y0, y1)
+struct SDFRect {
+    SDFRect() : x0(0), y0(0), x1(0), y1(0) {}
+    SDFRect(int x0In, int y0In, int x1In, int y1In) : x0(x0In), y0(y0In), x1(x1In), y1(y1In) {}
+
+    bool IsEmpty() const { return x1 <= x0 || y1 <= y0; }
+
+    SDFRect Union(const SDFRect& rhs) const {
+        if (IsEmpty()) {
+            return rhs;
+        } else if (rhs.IsEmpty()) {
+            return *this;
+        }
+        return SDFRect(std::min(x0, rhs.x0), std::min(y0, rhs.y0), std::max(x1, rhs.x1), std::max(y1, rhs.y1));
+    }
+
+    SDFRect Intersect(const SDFRect& rhs) const {
+        SDFRect r(std::max(x0, rhs.x0), std::max(y0, rhs.y0), std::min(x1, rhs.x1), std::min(y1, rhs.y1));
+        return r.IsEmpty() ? SDFRect() : r;
+    }
+
+    int x0, y0, x1, y1;
+};
 
 class SDFScene {
 public:
-    SDFScene();
+    // id stored for texels that no prim owns.
+    static const uint16_t NO_ID = 0xffff;
+
+    enum Flags {
+        GradientFlag = 0x01,     // bake a gradient channel alongside the distance buffer
+        ReferenceEvalFlag = 0x02, // transform every texel through world space, slower, for comparison
+        AdaptiveFlag = 0x04,      // keep distances in an adaptive quadtree, the buffer is rasterized from it
+        NearestCacheFlag = 0x08,  // keep the nearest baked prims of every texel, see RemovePrim()
+        ProgressiveFlag = 0x10    // bake coarse first and refine with RefineBake(), not with AdaptiveFlag
+    };
+
+    // baked prims cached per texel with NearestCacheFlag, only prims within MAX_DISTANCE count.
+    static const int NEAREST_CACHE_SIZE = 4;
+
+    SDFScene(unsigned int flags = 0);
     ~SDFScene();
 
     int GetSize() const { return _size; }
     const float* GetBuffer() const { return _buffer; }
 
-    void AddCircle(const glm::vec2& pos, float radius);
+    // two floats (d/dx, d/dy) per texel, NULL unless constructed with GradientFlag.
+    const float* GetGradientBuffer() const { return _gradBuffer; }
+
+    // one 16-bit id per texel, naming the prim whose surface is nearest.
+    // baked prims use their index in _prims, stamped prims get the id returned by AddCircle.
+    const uint16_t* GetIdBuffer() const { return _idBuffer; }
+
+    // the adaptive store edits are applied to, NULL unless constructed with AdaptiveFlag.
+    // The buffers above are then a dense copy of it, for display.
+    const SDFQuadtree* GetQuadtree() const { return _quadtree; }
+
+    // progressive bake, with ProgressiveFlag the constructor only samples every 8th texel
+    // and fills the rest in bilinearly, which takes a few milliseconds.  Each RefineBake()
+    // then samples twice as densely, every 4th, 2nd and finally every texel, and adds the
+    // buffer to the dirty rect, so each level can be shown as it is done.  Only the new
+    // samples of a level are baked.  Returns true once every texel is baked, the nearest
+    // cache of a NearestCacheFlag scene is built then too.  Edits applied in the meantime
+    // are re-applied over each level, so the final buffer matches a full bake, but with a
+    // history or journal set the bake is finished before the edit, as it is before
+    // RemovePrim(), MovePrim() and UpdateNodes() fix up texels.  Not while a BeginEdits()
+    // batch is under way.
+    bool RefineBake();
+    void FinishBake();
+
+    // samples between baked texels, 1 once the bake is done.
+    int GetBakeStep() const { return _bakeStep; }
+
+    // starts the bake over from the baked prims, any edits applied so far are lost.
+    // Progressive unless the scene is adaptive, that is rebuilt in one go.
+    void BeginBake();
+
+    // the buffers were filled in full some other way, as from a journal checkpoint, the
+    // rest of the bake and the edits kept for it are dropped.
+    void SkipBake();
+
+    // baked prims, including removed ones, their index is their id.
+    int GetNumPrims() const;
+
+    // remove or move a baked prim.  Only the texels the prim reached before and after are
+    // fixed up.  With NearestCacheFlag they come from the prims cached for each texel, and
+    // only texels whose cache runs out are evaluated against every prim, otherwise they are
+    // re-baked.  Edits applied over those texels are lost, they are rewritten from the baked
+    // prims.  Distances and ids within MAX_DISTANCE of a prim match a full bake, further out
+    // the distance is clamped anyway and ids are only refreshed near the prim.  Not recorded
+    // by a journal, and the buffers of an adaptive scene aren't fixed up.  False if the prim
+    // doesn't exist or was removed.
+    bool RemovePrim(int index);
+    bool MovePrim(int index, const glm::vec2& pos, float angle);
+
+    // scene graph over the baked prims.  Node 0 is the root, with the identity transform,
+    // a prim belongs to one node and its transform is relative to it.  World transforms
+    // and bounds are cached, moving a node only marks it, UpdateNodes() then recomputes the
+    // moved subtrees and fixes up the texels their prims reached before and reach now, as
+    // MovePrim() does.  The house and tree of the default scene are nodes 1 and 2.
+    int AddNode(int parent, const glm::vec2& pos, float angle);
+    int GetNumNodes() const;
+
+    // moves a prim into node, keeping where it is in the world.
+    bool SetPrimNode(int prim, int node);
+
+    // transform relative to the parent, rotation by angle then translation by pos.
+    bool SetNodeTransform(int node, const glm::vec2& pos, float angle);
+
+    // world space bounds of every prim under node as of the last UpdateNodes(),
+    // false if there are none.
+    bool GetNodeBounds(int node, glm::vec2& min, glm::vec2& max) const;
+
+    void UpdateNodes();
+
+    // apply a single edit, returns the id of an add or NO_ID for a rem.
+    uint16_t ApplyEdit(const SDFEdit& edit);
+
+    // apply a batch of edits in a single pass over the texels they reach, the result is the
+    // same as calling ApplyEdit() on each in order.  If ids is non-NULL it receives the id of
+    // each add, or NO_ID for each rem.
+    void ApplyEdits(const std::vector<SDFEdit>& edits, std::vector<uint16_t>* ids = NULL);
+
+    // ApplyEdits() spread over several calls, so a large batch never holds up the caller for
+    // long.  BeginEdits() prepares the batch and fills ids, then each StepEdits() applies it
+    // to up to maxTiles more tiles of 32x32 texels and adds them to the dirty rect, so the
+    // tiles can be shown as they finish while the rest still hold the state before the
+    // batch.  Returns true once the batch is applied and recorded.  No other edit or
+    // RemovePrim() / MovePrim() may come in between.
+    void BeginEdits(const std::vector<SDFEdit>& edits, std::vector<uint16_t>* ids = NULL);
+    bool StepEdits(int maxTiles);
+    bool IsEditing() const { return _editing; }
+
+    // every edit applied from here on is recorded in journal, which must outlive the scene
+    // or be detached with SetJournal(NULL).  See SDFJournal::Replay() to rebuild a scene.
+    void SetJournal(SDFJournal* journal) { _journal = journal; }
+
+    // the tiles every edit is about to modify are saved to history first, see SDFHistory.
+    void SetHistory(SDFHistory* history) { _history = history; }
+    SDFHistory* GetHistory() const { return _history; }
+
+    // dynamic layers are combined with the scene's own buffers, the static layer, when read
+    // with CompositeRow().  Edits only ever go to the static layer, a dynamic layer holds a
+    // set of prims that is replaced as a whole, so moving objects never re-evaluate the
+    // static world.  Layers are combined in the order they were added.
+    enum LayerOp {
+        UnionLayer = 0, // the layer's prims are added, and own the texels where they are nearer
+        SubtractLayer   // the layer's prims are carved out
+    };
+
+    // returns the index of the new layer, which starts out empty.  k is the blend width
+    // with the layers below, zero for a hard union or subtraction.
+    int AddLayer(LayerOp op, float k = 0.0f);
+    int GetNumLayers() const { return (int)_layers.size(); }
+
+    // replaces the prims of a layer.  The op of each edit is ignored, the prims of a layer
+    // are a hard union of each other.  Prims are matched up by index with the ones set last
+    // time, and only the texels near the prims that changed are re-evaluated, against just
+    // the prims near them, so moving a few prims a frame stays cheap however many there are.
+    // Once the layer has held as many prims as it does now, this doesn't allocate.  Adds
+    // the texels of the old and new prims to the dirty rect.
+    void SetLayerPrims(int layer, const std::vector<SDFEdit>& prims);
+
+    // the same as EvalDistance() but over the prims of a layer, only the ones near pos are
+    // evaluated.  Not safe alongside SetLayerPrims() on another thread.
+    float EvalLayerDistance(int layer, const glm::vec2& pos, glm::vec2* gradient = NULL) const;
+
+    // texels [x0, x0 + n) of row y with every layer applied, ids and all.  The gradient
+    // buffer is only kept for the static layer.
+    void CompositeRow(int y, int x0, int n, float* dist, uint16_t* ids) const;
+
+    // bakes edits, given in the prototype's local space, into a prototype for
+    // SDFEdit::MakeInstance().  Any thread.
+    static std::shared_ptr<const SDFPrototype> BakePrototype(const std::vector<SDFEdit>& edits);
+
+    // reserve an id for an edit that will be applied later, safe to call from any thread.
+    uint16_t AllocId();
+
+    uint16_t AddCircle(const glm::vec2& pos, float radius);
     void RemCircle(const glm::vec2& pos, float radius);
 
+    // closed polygon with any number of points, the sign comes from the crossing number
+    // so self intersecting polygons follow the even-odd rule.
+    uint16_t AddPolygon(const std::vector<glm::vec2>& points);
+    void RemPolygon(const std::vector<glm::vec2>& points);
+
+    // open chain of segments, thickened by halfWidth.  A single point makes a circle.
+    // pass the id returned by an earlier add to continue it, otherwise a new id is allocated.
+    uint16_t AddPolyline(const std::vector<glm::vec2>& points, float halfWidth, uint16_t id = NO_ID);
+    void RemPolyline(const std::vector<glm::vec2>& points, float halfWidth);
+
+    // texels modified since the last ClearDirtyRect(), the whole buffer after construction.
+    const SDFRect& GetDirtyRect() const { return _dirtyRect; }
+    void ClearDirtyRect() { _dirtyRect = SDFRect(); }
+
+    // evaluate the prims at a world space point, if gradient is non-NULL the exact
+    // gradient is computed in the same pass using dual numbers.
+    float EvalDistance(const glm::vec2& pos, glm::vec2* gradient = NULL) const;
+
+    glm::vec2 BufferToWorld(const glm::vec2& bufferPoint) const;
+    glm::vec2 WorldToBuffer(const glm::vec2& worldPoint) const;
+
     int GetSamplesPerMeter() const;
 
     int _size;
     float* _buffer;
+    float* _gradBuffer;
+    uint16_t* _idBuffer;
+    SDFQuadtree* _quadtree;
+    SDFNearestCache* _nearestCache;
+    SDFEditPass* _editPass;
+    bool _editing;
+    int _bakeStep;
+    std::vector<PrimEdit> _bakeEdits;  // applied since the bake began
+    SDFJournal* _journal;
+    SDFHistory* _history;
+    bool _referenceEval;
+    std::atomic<uint16_t> _nextId;
+    SDFRect _dirtyRect;
     std::vector<Prim> _prims;
+    std::vector<SDFLayer*> _layers;
+    std::vector<SDFNode*> _nodes;
+
+protected:
+    uint16_t StampPrim(const Prim& prim, uint16_t id = NO_ID);
+    void CarvePrim(const Prim& prim);
+    void ApplyPrimEdits(const std::vector<PrimEdit>& primEdits, const SDFRect& bounds);
+    void MarkBoundsDirty(int node);
+    void UpdateNode(int index, bool parentMoved, std::vector<int>& indices, std::vector<SDFRect>& oldRects);
+    void UpdatePrims(const std::vector<int>& indices, const std::vector<SDFRect>& oldRects);
+    void KeepBakeEdits(const std::vector<PrimEdit>& primEdits);
+    void DrawPrims(const SDFRect& rect, int step = 1);
+    void DrawSamples(const SDFRect& rect, int step, int skip);
+};
+
+// A single stamp or carve.  Edits can be built on any thread, queued, and applied
+// later with SDFScene::ApplyEdit().
+struct SDFEdit {
+    enum Op { Add = 0, Rem };
+    enum Type { Circle = 0, Box, Polygon, Polyline, Instance };  // same values as Prim::type
+
+    static SDFEdit MakeCircle(Op op, const glm::vec2& pos, float radius);
+    static SDFEdit MakeBox(Op op, const glm::vec2& pos, float angle, const glm::vec2& halfExtents);
+    static SDFEdit MakePolygon(Op op, const std::vector<glm::vec2>& points);
+    static SDFEdit MakePolyline(Op op, const std::vector<glm::vec2>& points, float halfWidth);
+
+    // the whole prototype as one prim, rotated by angle then moved to pos.  The edit's k
+    // blends it with the scene, the prototype's own blends were baked into it.
+    static SDFEdit MakeInstance(Op op, const std::shared_ptr<const SDFPrototype>& proto, const glm::vec2& pos, float angle);
+
+    // true if earlier can be dropped when this edit follows it without changing the result,
+    // only ever for hard blends.
+    bool Covers(const SDFEdit& earlier) const;
+
+    Op op;
+    Type type;
+    glm::vec2 pos;
+    float angle;
+    glm::vec2 r;  // circle & polyline: r.x is the radius, box: half extents
+    float k;      // smooth blend width, zero for a hard union or subtraction
+    uint16_t id;  // add only, NO_ID allocates a new id when applied
+    std::shared_ptr<const SDFPolygon> poly;  // polygon & polyline only
+    std::shared_ptr<const SDFPrototype> proto;  // instance only
 };
 
 #endif
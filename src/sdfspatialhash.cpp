@@ -0,0 +1,162 @@
+//
+//  sdfspatialhash.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfspatialhash.h"
+
+#include <math.h>
+#include <stdint.h>
+
+SDFSpatialHash::SDFSpatialHash(const glm::vec2& origin, float cellSize, int numBuckets) :
+    _origin(origin), _cellSize(cellSize), _invCellSize(1.0f / cellSize), _freeItem(-1), _freeLink(-1), _numItems(0) {
+    int n = 1;
+    while (n < numBuckets) {
+        n <<= 1;
+    }
+    _bucketMask = n - 1;
+    _buckets.assign(n, -1);
+}
+
+int SDFSpatialHash::Insert(const glm::vec2& min, const glm::vec2& max, int value) {
+    int handle = _freeItem;
+    if (handle >= 0) {
+        _freeItem = _items[handle].nextFree;
+    } else {
+        handle = (int)_items.size();
+        _items.push_back(Item());
+    }
+    Item& item = _items[handle];
+    item.min = min;
+    item.max = max;
+    item.value = value;
+    item.nextFree = -1;
+    GetCell(min, item.x0, item.y0);
+    GetCell(max, item.x1, item.y1);
+    LinkCells(handle);
+    _numItems++;
+    return handle;
+}
+
+void SDFSpatialHash::Move(int handle, const glm::vec2& min, const glm::vec2& max) {
+    Item& item = _items[handle];
+    item.min = min;
+    item.max = max;
+    int x0, y0, x1, y1;
+    GetCell(min, x0, y0);
+    GetCell(max, x1, y1);
+    if (x0 == item.x0 && y0 == item.y0 && x1 == item.x1 && y1 == item.y1) {
+        return;
+    }
+    UnlinkCells(handle);
+    item.x0 = x0;
+    item.y0 = y0;
+    item.x1 = x1;
+    item.y1 = y1;
+    LinkCells(handle);
+}
+
+void SDFSpatialHash::Remove(int handle) {
+    UnlinkCells(handle);
+    _items[handle].nextFree = _freeItem;
+    _freeItem = handle;
+    _numItems--;
+}
+
+void SDFSpatialHash::Clear() {
+    // keeps the pools, everything goes back on the free lists
+    _buckets.assign(_buckets.size(), -1);
+    _freeItem = -1;
+    for (int i = (int)_items.size() - 1; i >= 0; i--) {
+        _items[i].nextFree = _freeItem;
+        _freeItem = i;
+    }
+    _freeLink = -1;
+    for (int i = (int)_links.size() - 1; i >= 0; i--) {
+        _links[i].next = _freeLink;
+        _freeLink = i;
+    }
+    _numItems = 0;
+}
+
+void SDFSpatialHash::GetCell(const glm::vec2& p, int& cx, int& cy) const {
+    cx = (int)floorf((p.x - _origin.x) * _invCellSize);
+    cy = (int)floorf((p.y - _origin.y) * _invCellSize);
+}
+
+void SDFSpatialHash::QueryCell(int cx, int cy, std::vector<int>& out) const {
+    out.clear();
+    for (int i = _buckets[GetBucket(cx, cy)]; i >= 0; i = _links[i].next) {
+        const Link& link = _links[i];
+        // other cells share the bucket
+        if (link.cx == cx && link.cy == cy) {
+            out.push_back(_items[link.item].value);
+        }
+    }
+}
+
+void SDFSpatialHash::Query(const glm::vec2& p, std::vector<int>& out) const {
+    int cx, cy;
+    GetCell(p, cx, cy);
+    QueryCell(cx, cy, out);
+}
+
+size_t SDFSpatialHash::GetMemorySize() const {
+    return _buckets.capacity() * sizeof(int) + _items.capacity() * sizeof(Item) + _links.capacity() * sizeof(Link);
+}
+
+int SDFSpatialHash::GetBucket(int cx, int cy) const {
+    uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+    return (int)(h & (uint32_t)_bucketMask);
+}
+
+void SDFSpatialHash::LinkCells(int handle) {
+    Item& item = _items[handle];
+    item.firstLink = -1;
+    for (int cy = item.y0; cy <= item.y1; cy++) {
+        for (int cx = item.x0; cx <= item.x1; cx++) {
+            int i = _freeLink;
+            if (i >= 0) {
+                _freeLink = _links[i].next;
+            } else {
+                i = (int)_links.size();
+                _links.push_back(Link());
+            }
+            Link& link = _links[i];
+            int bucket = GetBucket(cx, cy);
+            link.item = handle;
+            link.cx = cx;
+            link.cy = cy;
+            link.prev = -1;
+            link.next = _buckets[bucket];
+            if (link.next >= 0) {
+                _links[link.next].prev = i;
+            }
+            _buckets[bucket] = i;
+            link.nextInItem = _items[handle].firstLink;
+            _items[handle].firstLink = i;
+        }
+    }
+}
+
+void SDFSpatialHash::UnlinkCells(int handle) {
+    int i = _items[handle].firstLink;
+    while (i >= 0) {
+        Link& link = _links[i];
+        if (link.prev >= 0) {
+            _links[link.prev].next = link.next;
+        } else {
+            _buckets[GetBucket(link.cx, link.cy)] = link.next;
+        }
+        if (link.next >= 0) {
+            _links[link.next].prev = link.prev;
+        }
+        int next = link.nextInItem;
+        link.next = _freeLink;
+        _freeLink = i;
+        i = next;
+    }
+    _items[handle].firstLink = -1;
+}
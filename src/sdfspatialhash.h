@@ -0,0 +1,84 @@
+//
+//  sdfspatialhash.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFSpatialHash_h
+#define hifi_SDFSpatialHash_h
+
+#include <stddef.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Uniform grid over world space boxes, for prims that move every frame.  Cells are
+// hashed into a fixed number of buckets so the grid is unbounded, and each box is
+// linked into every cell it overlaps.  Insert, Remove and Move cost one link per cell
+// the box covers, so for boxes no bigger than a few cells they are O(1), and a Move
+// that stays in the same cells only stores the new box.
+//
+// Links and items come from pools that only grow, once they are as big as the largest
+// frame needs nothing is allocated.
+class SDFSpatialHash {
+public:
+    // numBuckets is rounded up to a power of two.  Cell (0, 0) starts at origin.
+    SDFSpatialHash(const glm::vec2& origin, float cellSize, int numBuckets = 1024);
+
+    // returns a handle for the box, value is handed back by the queries.
+    int Insert(const glm::vec2& min, const glm::vec2& max, int value);
+    void Move(int handle, const glm::vec2& min, const glm::vec2& max);
+    void Remove(int handle);
+    void Clear();
+
+    int GetValue(int handle) const { return _items[handle].value; }
+    int GetNumItems() const { return _numItems; }
+    float GetCellSize() const { return _cellSize; }
+
+    // cell containing world point p.
+    void GetCell(const glm::vec2& p, int& cx, int& cy) const;
+
+    // values of every box overlapping cell (cx, cy), each once, in no particular order.
+    // out is cleared first, pass the same vector every time so it stops allocating.
+    void QueryCell(int cx, int cy, std::vector<int>& out) const;
+
+    // same for the cell containing p.  A box grown by the distance a prim can reach
+    // is returned for every point that prim can affect.
+    void Query(const glm::vec2& p, std::vector<int>& out) const;
+
+    size_t GetMemorySize() const;
+
+protected:
+    struct Item {
+        glm::vec2 min, max;
+        int x0, y0, x1, y1;  // cells covered, inclusive
+        int firstLink;       // chained through Link::nextInItem
+        int value;
+        int nextFree;
+    };
+
+    // one box in one cell, doubly linked in its bucket so it unlinks in O(1).
+    struct Link {
+        int item;
+        int cx, cy;
+        int prev, next;      // in the bucket
+        int nextInItem;
+    };
+
+    int GetBucket(int cx, int cy) const;
+    void LinkCells(int handle);
+    void UnlinkCells(int handle);
+
+    glm::vec2 _origin;
+    float _cellSize;
+    float _invCellSize;
+    int _bucketMask;
+    std::vector<int> _buckets;  // first link or -1
+    std::vector<Item> _items;
+    std::vector<Link> _links;
+    int _freeItem;
+    int _freeLink;
+    int _numItems;
+};
+
+#endif
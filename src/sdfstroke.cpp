@@ -0,0 +1,45 @@
+//
+//  sdfstroke.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdfstroke.h"
+
+SDFStroke::SDFStroke(float radius, float spacing, bool remove, uint16_t id) :
+    _radius(radius), _spacing(spacing), _remove(remove), _hasLast(false), _id(id) {
+}
+
+void SDFStroke::AddPoint(const glm::vec2& worldPos) {
+    if (!_pending.empty() || _hasLast) {
+        const glm::vec2& prev = _pending.empty() ? _last : _pending.back();
+        if (glm::distance(prev, worldPos) < _spacing) {
+            return;
+        }
+    }
+    _pending.push_back(worldPos);
+}
+
+bool SDFStroke::Flush(SDFEdit& edit) {
+    if (_pending.empty()) {
+        return false;
+    }
+
+    // later chains start where the previous one ended, so the stroke stays connected.  Each
+    // chain keeps the smooth blend with the scene, at the joint that also blends it with
+    // the previous chain, see the bead noted in sdfstroke.h.
+    std::vector<glm::vec2> chain;
+    if (_hasLast) {
+        chain.push_back(_last);
+    }
+    chain.insert(chain.end(), _pending.begin(), _pending.end());
+
+    edit = SDFEdit::MakePolyline(_remove ? SDFEdit::Rem : SDFEdit::Add, chain, _radius);
+    edit.id = _id;
+
+    _last = chain.back();
+    _hasLast = true;
+    _pending.clear();
+    return true;
+}
@@ -0,0 +1,44 @@
+//
+//  sdfstroke.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFStroke_h
+#define hifi_SDFStroke_h
+
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sdfscene.h"
+
+// Accumulates a drag path into capsule chain edits.
+// Points can arrive at any rate, Flush() turns everything gathered since the
+// previous flush into a single polyline edit, so a stroke costs one edit per frame.
+// Every edit is smooth blended with the scene.  Where one edit starts, the previous one
+// ended and is the same distance away, so the blend bulges the stroke there by up to
+// k / 4, a small bead at each frame boundary of the stroke.
+class SDFStroke {
+public:
+    // points closer than spacing to the previous kept point are dropped.
+    // id is shared by every edit of an add stroke, see SDFScene::AllocId().
+    SDFStroke(float radius, float spacing, bool remove, uint16_t id = SDFScene::NO_ID);
+
+    void AddPoint(const glm::vec2& worldPos);
+
+    // build an edit from the pending points, returns false if there was nothing to do.
+    bool Flush(SDFEdit& edit);
+
+protected:
+    float _radius;
+    float _spacing;
+    bool _remove;
+    bool _hasLast;
+    uint16_t _id;
+    glm::vec2 _last;  // end of the previous chain
+    std::vector<glm::vec2> _pending;
+};
+
+#endif
@@ -0,0 +1,503 @@
+//
+//  sdftilecodec.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "sdftilecodec.h"
+#include "cpupath.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// stream layout, all fields little endian:
+//    0  char[4]   "SDFT"
+//    4  uint8_t   version
+//    5  uint8_t   flags, SDFTileDecoder::Flags
+//    6  uint16_t  tile size
+//    8  float     error bound
+//   12  float     quantization step, zero when lossless
+//   16  int32_t   x0, y0, x1, y1 of the tile aligned rect
+//   32  uint32_t  number of tiles
+//   36  uint32_t  offset of each tile plus the end of the last, relative to the payload
+//       payload, each tile starts on a byte boundary
+static const char MAGIC[4] = { 'S', 'D', 'F', 'T' };
+static const uint8_t VERSION = 1;
+static const size_t HEADER_SIZE = 36;
+
+// residual magnitudes are tracked over about this many texels.
+static const uint32_t RICE_RESET = 64;
+
+// quotients this large are escaped, the value follows as 32 raw bits.
+static const int RICE_ESCAPE = 24;
+
+// quantized distances are kept well inside an int32.
+static const float MAX_QUANTIZED = 1073741824.0f;
+
+template <typename T>
+static void write_field(uint8_t* dst, size_t offset, T value) {
+    memcpy(dst + offset, &value, sizeof(T));
+}
+
+template <typename T>
+static T read_field(const uint8_t* src, size_t offset) {
+    T value;
+    memcpy(&value, src + offset, sizeof(T));
+    return value;
+}
+
+static int count_trailing_zeros(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// LOCO-I style adaptive Rice parameter, the smallest k with count << k >= sum.
+struct RiceState {
+    RiceState() : sum(4), count(1) {}
+
+    int GetK() const {
+        int k = 0;
+        while (((uint64_t)count << k) < sum && k < 31) {
+            k++;
+        }
+        return k;
+    }
+
+    void Update(uint32_t u) {
+        sum += u;
+        if (++count == RICE_RESET) {
+            sum >>= 1;
+            count >>= 1;
+        }
+    }
+
+    uint64_t sum;
+    uint32_t count;
+};
+
+struct BitWriter {
+    BitWriter(std::vector<uint8_t>& outIn) : out(outIn), acc(0), count(0) {}
+
+    // n <= 32, bits above n must be zero.
+    void Write(uint32_t bits, int n) {
+        acc |= (uint64_t)bits << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((uint8_t)acc);
+            acc >>= 8;
+            count -= 8;
+        }
+    }
+
+    // pad to a byte boundary.
+    void Flush() {
+        if (count > 0) {
+            out.push_back((uint8_t)acc);
+        }
+        acc = 0;
+        count = 0;
+    }
+
+    std::vector<uint8_t>& out;
+    uint64_t acc;
+    int count;
+};
+
+// reads past the end as zeros, Overrun() tells if any were used.
+struct BitReader {
+    BitReader(const uint8_t* data, size_t length) : ptr(data), end(data + length), acc(0), count(0), consumed(0), length(length) {}
+
+    void Refill() {
+        if (end - ptr >= 8) {
+            // the bytes that only partly fit are loaded again next time, at the same place.
+            uint64_t v;
+            memcpy(&v, ptr, sizeof(v));
+            acc |= v << count;
+            int bytes = (63 - count) >> 3;
+            ptr += bytes;
+            count += bytes * 8;
+        } else {
+            while (count <= 56) {
+                if (ptr < end) {
+                    acc |= (uint64_t)*ptr++ << count;
+                }
+                count += 8;
+            }
+        }
+    }
+
+    // n <= 32, after a Refill() at most 56 bits can be taken.
+    uint32_t Read(int n) {
+        uint32_t bits = (uint32_t)(acc & ((1ull << n) - 1));
+        acc >>= n;
+        count -= n;
+        consumed += n;
+        return bits;
+    }
+
+    // zeros up to the next one bit, RICE_ESCAPE + 1 if there are too many.
+    int ReadUnary() {
+        Refill();
+        int q = acc ? count_trailing_zeros(acc) : 64;
+        if (q > RICE_ESCAPE) {
+            return RICE_ESCAPE + 1;
+        }
+        Read(q + 1);
+        return q;
+    }
+
+    bool Overrun() const { return consumed > length * 8; }
+
+    const uint8_t* ptr;
+    const uint8_t* end;
+    uint64_t acc;
+    int count;
+    size_t consumed;
+    size_t length;
+};
+
+static uint32_t zigzag(uint32_t r) {
+    return (r << 1) ^ (uint32_t)((int32_t)r >> 31);
+}
+
+static uint32_t unzigzag(uint32_t u) {
+    return (u >> 1) ^ (0u - (u & 1));
+}
+
+static void rice_encode(BitWriter& writer, const uint32_t* residuals, int n) {
+    RiceState state;
+    for (int i = 0; i < n; i++) {
+        uint32_t u = zigzag(residuals[i]);
+        int k = state.GetK();
+        uint32_t q = u >> k;
+        if (q < (uint32_t)RICE_ESCAPE) {
+            writer.Write(1u << q, (int)q + 1);
+            if (k > 0) {
+                writer.Write(u & (uint32_t)((1ull << k) - 1), k);
+            }
+        } else {
+            writer.Write(1u << RICE_ESCAPE, RICE_ESCAPE + 1);
+            writer.Write(u & 0xffff, 16);
+            writer.Write(u >> 16, 16);
+        }
+        state.Update(u);
+    }
+}
+
+static bool rice_decode(BitReader& reader, uint32_t* residuals, int n) {
+    RiceState state;
+    for (int i = 0; i < n; i++) {
+        int k = state.GetK();
+        int q = reader.ReadUnary();
+        uint32_t u;
+        if (q < RICE_ESCAPE) {
+            reader.Refill();
+            u = ((uint32_t)q << k) | (k > 0 ? reader.Read(k) : 0);
+        } else if (q == RICE_ESCAPE) {
+            reader.Refill();
+            u = reader.Read(16);
+            u |= reader.Read(16) << 16;
+        } else {
+            return false;
+        }
+        residuals[i] = unzigzag(u);
+        state.Update(u);
+    }
+    return !reader.Overrun();
+}
+
+// row kernels, compiled per instruction set, see cpupath.h.  Integer rows wrap, so
+// the prediction is exact for any input.
+
+// nearest multiple of the step, clamped so it fits.
+CPU_FORCE_INLINE static void quantize_row(const float* __restrict src, uint32_t* __restrict dst, int n, float invStep) {
+    for (int i = 0; i < n; i++) {
+        float v = floorf(src[i] * invStep + 0.5f);
+        v = v > -MAX_QUANTIZED ? v : -MAX_QUANTIZED;
+        v = v < MAX_QUANTIZED ? v : MAX_QUANTIZED;
+        dst[i] = (uint32_t)(int32_t)v;
+    }
+}
+
+CPU_FORCE_INLINE static void dequantize_row(const uint32_t* __restrict src, float* __restrict dst, int n, float step) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (float)(int32_t)src[i] * step;
+    }
+}
+
+// flips the magnitude bits of negative floats, so the bits order like the floats do,
+// as signed integers.  -0 and +0 stay distinct.  The same flip undoes it.
+CPU_FORCE_INLINE static void order_float_bits_row(const uint32_t* __restrict src, uint32_t* __restrict dst, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = src[i] ^ ((uint32_t)((int32_t)src[i] >> 31) & 0x7fffffff);
+    }
+}
+
+CPU_FORCE_INLINE static void add_row(uint32_t* __restrict dst, const uint32_t* __restrict src, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] += src[i];
+    }
+}
+
+typedef void (*QuantizeRowFunc)(const float* src, uint32_t* dst, int n, float invStep);
+typedef void (*DequantizeRowFunc)(const uint32_t* src, float* dst, int n, float step);
+typedef void (*OrderFloatBitsRowFunc)(const uint32_t* src, uint32_t* dst, int n);
+typedef void (*AddRowFunc)(uint32_t* dst, const uint32_t* src, int n);
+
+struct CodecKernels {
+    QuantizeRowFunc quantizeRow;
+    DequantizeRowFunc dequantizeRow;
+    OrderFloatBitsRowFunc orderFloatBitsRow;
+    AddRowFunc addRow;
+};
+
+#define CODEC_KERNEL_VARIANTS(suffix, target) \
+    target static void quantize_row_##suffix(const float* src, uint32_t* dst, int n, float invStep) { quantize_row(src, dst, n, invStep); } \
+    target static void dequantize_row_##suffix(const uint32_t* src, float* dst, int n, float step) { dequantize_row(src, dst, n, step); } \
+    target static void order_float_bits_row_##suffix(const uint32_t* src, uint32_t* dst, int n) { order_float_bits_row(src, dst, n); } \
+    target static void add_row_##suffix(uint32_t* dst, const uint32_t* src, int n) { add_row(dst, src, n); }
+
+CODEC_KERNEL_VARIANTS(sse2, )
+CODEC_KERNEL_VARIANTS(avx2, CPU_TARGET_AVX2)
+CODEC_KERNEL_VARIANTS(avx512, CPU_TARGET_AVX512)
+
+static const CodecKernels CODEC_KERNELS[NumCPUPaths] = {
+    { quantize_row_sse2, dequantize_row_sse2, order_float_bits_row_sse2, add_row_sse2 },
+    { quantize_row_avx2, dequantize_row_avx2, order_float_bits_row_avx2, add_row_avx2 },
+    { quantize_row_avx512, dequantize_row_avx512, order_float_bits_row_avx512, add_row_avx512 }
+};
+
+static const CodecKernels& codec_kernels() {
+    return CODEC_KERNELS[GetCPUPath()];
+}
+
+// mixed second difference of a w x h tile, texels outside the tile count as zero.
+static void predict_tile(const uint32_t* values, uint32_t* residuals, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        const uint32_t* row = values + y * w;
+        const uint32_t* up = y > 0 ? row - w : NULL;
+        for (int x = 0; x < w; x++) {
+            uint32_t west = x > 0 ? row[x - 1] : 0;
+            uint32_t north = up ? up[x] : 0;
+            uint32_t northWest = up && x > 0 ? up[x - 1] : 0;
+            residuals[y * w + x] = row[x] - west - north + northWest;
+        }
+    }
+}
+
+// undoes predict_tile in place, a running sum down the columns then along each row.
+// the column sums are whole rows at a time, the row sums are serial.
+static void unpredict_tile(uint32_t* values, int w, int h) {
+    const CodecKernels& kernels = codec_kernels();
+    for (int y = 1; y < h; y++) {
+        kernels.addRow(values + y * w, values + (y - 1) * w, w);
+    }
+    for (int y = 0; y < h; y++) {
+        uint32_t* row = values + y * w;
+        for (int x = 1; x < w; x++) {
+            row[x] += row[x - 1];
+        }
+    }
+}
+
+SDFTileEncoder::SDFTileEncoder(int tileSize, float errorBound) : _tileSize(std::max(tileSize, 1)), _errorBound(std::max(errorBound, 0.0f)) {
+}
+
+size_t SDFTileEncoder::Encode(const float* buffer, const uint16_t* idBuffer, int size, const SDFRect& rect, std::vector<uint8_t>& out) const {
+    const CodecKernels& kernels = codec_kernels();
+    int t = _tileSize;
+    SDFRect clipped = rect.Intersect(SDFRect(0, 0, size, size));
+    SDFRect aligned;
+    if (!clipped.IsEmpty()) {
+        aligned = SDFRect(clipped.x0 / t * t, clipped.y0 / t * t, std::min((clipped.x1 + t - 1) / t * t, size), std::min((clipped.y1 + t - 1) / t * t, size));
+    }
+    int tilesPerRow = aligned.IsEmpty() ? 0 : (aligned.x1 - aligned.x0 + t - 1) / t;
+    int tilesPerColumn = aligned.IsEmpty() ? 0 : (aligned.y1 - aligned.y0 + t - 1) / t;
+    uint32_t numTiles = (uint32_t)(tilesPerRow * tilesPerColumn);
+
+    // twice the bound, less the rounding of quantizing and scaling back the largest
+    // distance.  A bound too fine for float to honor falls back to lossless.
+    float maxAbs = 0.0f;
+    for (int y = aligned.y0; y < aligned.y1; y++) {
+        for (int x = aligned.x0; x < aligned.x1; x++) {
+            maxAbs = std::max(maxAbs, fabsf(buffer[y * size + x]));
+        }
+    }
+    float step = 2.0f * (_errorBound - 4.0f * FLT_EPSILON * maxAbs);
+    step = step > 0.0f && maxAbs / step < MAX_QUANTIZED ? step : 0.0f;
+    uint8_t flags = (idBuffer ? SDFTileDecoder::IdsFlag : 0) | (step > 0.0f ? SDFTileDecoder::QuantizedFlag : 0);
+
+    out.clear();
+    out.resize(HEADER_SIZE + 4 * (numTiles + 1));
+    memcpy(out.data(), MAGIC, sizeof(MAGIC));
+    write_field<uint8_t>(out.data(), 4, VERSION);
+    write_field<uint8_t>(out.data(), 5, flags);
+    write_field<uint16_t>(out.data(), 6, (uint16_t)t);
+    write_field<float>(out.data(), 8, _errorBound);
+    write_field<float>(out.data(), 12, step);
+    write_field<int32_t>(out.data(), 16, aligned.x0);
+    write_field<int32_t>(out.data(), 20, aligned.y0);
+    write_field<int32_t>(out.data(), 24, aligned.x1);
+    write_field<int32_t>(out.data(), 28, aligned.y1);
+    write_field<uint32_t>(out.data(), 32, numTiles);
+    size_t payloadStart = out.size();
+
+    std::vector<uint32_t> offsets(numTiles + 1);
+    std::vector<uint32_t> values(t * t);
+    std::vector<uint32_t> residuals(t * t);
+    BitWriter writer(out);
+    for (uint32_t i = 0; i < numTiles; i++) {
+        int x0 = aligned.x0 + (int)(i % tilesPerRow) * t;
+        int y0 = aligned.y0 + (int)(i / tilesPerRow) * t;
+        int w = std::min(t, aligned.x1 - x0);
+        int h = std::min(t, aligned.y1 - y0);
+        offsets[i] = (uint32_t)(out.size() - payloadStart);
+
+        for (int y = 0; y < h; y++) {
+            const float* src = buffer + (y0 + y) * size + x0;
+            if (step > 0.0f) {
+                kernels.quantizeRow(src, values.data() + y * w, w, 1.0f / step);
+            } else {
+                memcpy(values.data() + y * w, src, w * sizeof(float));
+                kernels.orderFloatBitsRow(values.data() + y * w, values.data() + y * w, w);
+            }
+        }
+        predict_tile(values.data(), residuals.data(), w, h);
+        rice_encode(writer, residuals.data(), w * h);
+
+        if (idBuffer) {
+            for (int y = 0; y < h; y++) {
+                const uint16_t* src = idBuffer + (y0 + y) * size + x0;
+                for (int x = 0; x < w; x++) {
+                    values[y * w + x] = src[x];
+                }
+            }
+            predict_tile(values.data(), residuals.data(), w, h);
+            rice_encode(writer, residuals.data(), w * h);
+        }
+        writer.Flush();
+    }
+    offsets[numTiles] = (uint32_t)(out.size() - payloadStart);
+    memcpy(out.data() + HEADER_SIZE, offsets.data(), offsets.size() * sizeof(uint32_t));
+    return out.size();
+}
+
+SDFTileDecoder::SDFTileDecoder() : _payload(NULL), _payloadLength(0), _index(NULL), _numTiles(0), _flags(0), _tileSize(0), _errorBound(0.0f), _step(0.0f), _tilesPerRow(0) {
+}
+
+bool SDFTileDecoder::Open(const uint8_t* data, size_t length) {
+    _numTiles = 0;
+    if (!data || length < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || read_field<uint8_t>(data, 4) != VERSION) {
+        return false;
+    }
+    _flags = read_field<uint8_t>(data, 5);
+    _tileSize = read_field<uint16_t>(data, 6);
+    _errorBound = read_field<float>(data, 8);
+    _step = read_field<float>(data, 12);
+    _rect = SDFRect(read_field<int32_t>(data, 16), read_field<int32_t>(data, 20), read_field<int32_t>(data, 24), read_field<int32_t>(data, 28));
+    uint32_t numTiles = read_field<uint32_t>(data, 32);
+    if (_tileSize <= 0 || ((_flags & QuantizedFlag) && !(_step > 0.0f))) {
+        return false;
+    }
+
+    int t = _tileSize;
+    _tilesPerRow = _rect.IsEmpty() ? 0 : (_rect.x1 - _rect.x0 + t - 1) / t;
+    int tilesPerColumn = _rect.IsEmpty() ? 0 : (_rect.y1 - _rect.y0 + t - 1) / t;
+    if ((uint64_t)_tilesPerRow * (uint64_t)tilesPerColumn != numTiles || (length - HEADER_SIZE) / 4 < (uint64_t)numTiles + 1) {
+        return false;
+    }
+
+    _index = data + HEADER_SIZE;
+    _payload = _index + 4 * ((size_t)numTiles + 1);
+    _payloadLength = length - HEADER_SIZE - 4 * ((size_t)numTiles + 1);
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i <= numTiles; i++) {
+        uint32_t offset = read_field<uint32_t>(_index, 4 * i);
+        if (offset < prev || offset > _payloadLength) {
+            return false;
+        }
+        prev = offset;
+    }
+    _numTiles = numTiles;
+    return true;
+}
+
+SDFRect SDFTileDecoder::GetTileRect(int index) const {
+    if (index < 0 || index >= (int)_numTiles) {
+        return SDFRect();
+    }
+    int x0 = _rect.x0 + (index % _tilesPerRow) * _tileSize;
+    int y0 = _rect.y0 + (index / _tilesPerRow) * _tileSize;
+    return SDFRect(x0, y0, std::min(x0 + _tileSize, _rect.x1), std::min(y0 + _tileSize, _rect.y1));
+}
+
+int SDFTileDecoder::FindTile(int x, int y) const {
+    if (_numTiles == 0 || x < _rect.x0 || y < _rect.y0 || x >= _rect.x1 || y >= _rect.y1) {
+        return -1;
+    }
+    return ((y - _rect.y0) / _tileSize) * _tilesPerRow + (x - _rect.x0) / _tileSize;
+}
+
+bool SDFTileDecoder::DecodeTile(int index, float* buffer, uint16_t* idBuffer, int size) const {
+    SDFRect rect = GetTileRect(index);
+    if (rect.IsEmpty() || rect.x1 > size || rect.y1 > size) {
+        return false;
+    }
+    const CodecKernels& kernels = codec_kernels();
+    int w = rect.x1 - rect.x0;
+    int h = rect.y1 - rect.y0;
+    uint32_t start = read_field<uint32_t>(_index, 4 * index);
+    uint32_t end = read_field<uint32_t>(_index, 4 * (index + 1));
+    BitReader reader(_payload + start, end - start);
+
+    std::vector<uint32_t> values(w * h);
+    uint32_t* v = values.data();
+    if (!rice_decode(reader, v, w * h)) {
+        return false;
+    }
+    unpredict_tile(v, w, h);
+    for (int y = 0; y < h; y++) {
+        float* dst = buffer + (rect.y0 + y) * size + rect.x0;
+        if (_flags & QuantizedFlag) {
+            kernels.dequantizeRow(v + y * w, dst, w, _step);
+        } else {
+            kernels.orderFloatBitsRow(v + y * w, v + y * w, w);
+            memcpy(dst, v + y * w, w * sizeof(float));
+        }
+    }
+
+    if ((_flags & IdsFlag) && idBuffer) {
+        if (!rice_decode(reader, v, w * h)) {
+            return false;
+        }
+        unpredict_tile(v, w, h);
+        for (int y = 0; y < h; y++) {
+            uint16_t* dst = idBuffer + (rect.y0 + y) * size + rect.x0;
+            for (int x = 0; x < w; x++) {
+                dst[x] = (uint16_t)v[y * w + x];
+            }
+        }
+    }
+    return true;
+}
+
+bool SDFTileDecoder::Decode(float* buffer, uint16_t* idBuffer, int size) const {
+    for (int i = 0; i < (int)_numTiles; i++) {
+        if (!DecodeTile(i, buffer, idBuffer, size)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+//
+//  sdftilecodec.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_SDFTileCodec_h
+#define hifi_SDFTileCodec_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "sdfscene.h"
+
+// Compression for square tiles of an SDFScene's distance and id buffers, for
+// snapshots, paging and shipping edits.
+//
+// Distances are turned into integers, quantized to the error bound or, for a bound of
+// zero, the float bits reordered so nearby floats are nearby integers.  Each texel is
+// predicted from its left, upper and upper left neighbors (x - W - N + NW, the mixed
+// second difference), which is exactly zero wherever the field is planar, so nearly
+// every residual of a distance field is tiny.  Residuals are Rice coded with a
+// parameter that adapts as the tile is read.
+//
+// Tiles are coded independently and the stream starts with an index of their offsets,
+// any tile can be decoded without touching the others.  Streams are little endian.
+
+// writes a stream, keeps no state between calls.
+class SDFTileEncoder {
+public:
+    // errorBound of zero is lossless, otherwise every decoded distance is within
+    // errorBound of the original.
+    SDFTileEncoder(int tileSize = 32, float errorBound = 0.0f);
+
+    // encodes every tile rect touches, on a grid of tileSize aligned to texel (0, 0).
+    // idBuffer may be NULL, then only distances are stored.  Returns the stream size.
+    size_t Encode(const float* buffer, const uint16_t* idBuffer, int size, const SDFRect& rect, std::vector<uint8_t>& out) const;
+
+protected:
+    int _tileSize;
+    float _errorBound;
+};
+
+// reads a stream in place, data must outlive the decoder.
+class SDFTileDecoder {
+public:
+    SDFTileDecoder();
+
+    // checks the header and tile index, false if data is not a complete stream.
+    bool Open(const uint8_t* data, size_t length);
+
+    int GetNumTiles() const { return (int)_numTiles; }
+    bool HasIds() const { return (_flags & IdsFlag) != 0; }
+    float GetErrorBound() const { return _errorBound; }
+
+    // texels covered by tile index, in the buffer the stream was encoded from.
+    SDFRect GetTileRect(int index) const;
+
+    // index of the tile holding texel (x, y), or -1 if the stream doesn't cover it.
+    int FindTile(int x, int y) const;
+
+    // decodes one tile into its place in a size x size buffer.  idBuffer may be NULL to
+    // skip ids, it is left untouched if the stream has none.  False on a corrupt tile.
+    bool DecodeTile(int index, float* buffer, uint16_t* idBuffer, int size) const;
+
+    // every tile, stops at the first corrupt one.
+    bool Decode(float* buffer, uint16_t* idBuffer, int size) const;
+
+    enum Flags {
+        IdsFlag = 0x01,
+        QuantizedFlag = 0x02  // distances are multiples of the quantization step, otherwise float bits
+    };
+
+protected:
+    const uint8_t* _payload;
+    size_t _payloadLength;
+    const uint8_t* _index;  // _numTiles + 1 offsets relative to _payload, read with memcpy
+    uint32_t _numTiles;
+    uint8_t _flags;
+    int _tileSize;
+    float _errorBound;
+    float _step;
+    SDFRect _rect;  // tile aligned
+    int _tilesPerRow;
+};
+
+#endif
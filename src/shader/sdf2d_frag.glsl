@@ -1,12 +1,21 @@
 uniform vec4 color;
 uniform sampler2D sdfTexture;
+uniform sampler2D idTexture;
+uniform vec2 sdfDecode;  // dist = texel * sdfDecode.x + sdfDecode.y, undoes the narrow band encodings
 varying vec2 frag_uv;
 
 #define STRIPES 0
+#define MATERIALS 1
+
+// pseudo random color for a prim id
+vec3 idColor(float id)
+{
+    return 0.3 + 0.6 * fract(sin(vec3(id) * vec3(12.9898, 78.233, 37.719)) * 43758.5453);
+}
 
 void main(void)
 {
-    float dist = texture2D(sdfTexture, frag_uv).r;
+    float dist = texture2D(sdfTexture, frag_uv).r * sdfDecode.x + sdfDecode.y;
 
 #if STRIPES
     float s1 = 1.0 - exp(-3.0 * abs(dist));
@@ -17,6 +26,11 @@ void main(void)
     c.g = (1.0 - sign(dist) * 0.4) * shade;
     c.b = (1.0 - sign(dist) * 0.7) * shade;
     gl_FragColor = vec4(c, color.a);
+#elif MATERIALS
+    // ids are uploaded as normalized 16-bit values
+    float id = floor(texture2D(idTexture, frag_uv).r * 65535.0 + 0.5);
+    vec3 c = mix(idColor(id), vec3(1.0), step(0.0, dist));
+    gl_FragColor = vec4(c, color.a);
 #else
     float c = step(0.0, dist);
 	gl_FragColor = vec4(c, c, c, color.a);
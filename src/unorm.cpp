@@ -0,0 +1,125 @@
+//
+//  unorm.cpp
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "unorm.h"
+#include "cpupath.h"
+
+#include <math.h>
+
+// 4x4 bayer matrix, (b + 0.5) / 16 so the offsets average to the 0.5 of plain rounding.
+static const float BAYER_4X4[16] = {
+     0.5f / 16.0f,  8.5f / 16.0f,  2.5f / 16.0f, 10.5f / 16.0f,
+    12.5f / 16.0f,  4.5f / 16.0f, 14.5f / 16.0f,  6.5f / 16.0f,
+     3.5f / 16.0f, 11.5f / 16.0f,  1.5f / 16.0f,  9.5f / 16.0f,
+    15.5f / 16.0f,  7.5f / 16.0f, 13.5f / 16.0f,  5.5f / 16.0f
+};
+
+// the pattern repeats every 4 texels, 16 entries fill a whole avx512 register at any x.
+static const int OFFSET_ROW_SIZE = 16;
+
+template <typename T, uint32_t MAX>
+CPU_FORCE_INLINE T encode(float d, float scale, float bias, float offset) {
+    // floor(v + offset) on a value already clamped to [0, MAX], truncation is the floor.
+    float v = d * scale + bias + offset;
+    v = v > 0.0f ? v : 0.0f;
+    v = v < (float)MAX ? v : (float)MAX;
+    return (T)(int32_t)v;
+}
+
+template <typename T, uint32_t MAX>
+CPU_FORCE_INLINE void encode_row(const float* __restrict src, T* __restrict dst, int n, float band, int x, int y, bool dither) {
+    float scale = 0.5f * (float)MAX / band;
+    float bias = 0.5f * (float)MAX;
+    float offsets[OFFSET_ROW_SIZE];
+    for (int j = 0; j < OFFSET_ROW_SIZE; j++) {
+        offsets[j] = dither ? BAYER_4X4[(y & 3) * 4 + ((x + j) & 3)] : 0.5f;
+    }
+
+    int i = 0;
+    for (; i + OFFSET_ROW_SIZE <= n; i += OFFSET_ROW_SIZE) {
+        for (int j = 0; j < OFFSET_ROW_SIZE; j++) {
+            dst[i + j] = encode<T, MAX>(src[i + j], scale, bias, offsets[j]);
+        }
+    }
+    for (; i < n; i++) {
+        dst[i] = encode<T, MAX>(src[i], scale, bias, offsets[i & (OFFSET_ROW_SIZE - 1)]);
+    }
+}
+
+template <typename T, uint32_t MAX>
+CPU_FORCE_INLINE void decode_row(const T* __restrict src, float* __restrict dst, int n, float band) {
+    // same expression as unorm8_to_distance() and unorm16_to_distance()
+    float step = 2.0f * band / (float)MAX;
+    for (int i = 0; i < n; i++) {
+        dst[i] = (float)src[i] * step - band;
+    }
+}
+
+typedef void (*EncodeUnorm8Func)(const float* src, uint8_t* dst, int n, float band, int x, int y, bool dither);
+typedef void (*EncodeUnorm16Func)(const float* src, uint16_t* dst, int n, float band, int x, int y, bool dither);
+typedef void (*DecodeUnorm8Func)(const uint8_t* src, float* dst, int n, float band);
+typedef void (*DecodeUnorm16Func)(const uint16_t* src, float* dst, int n, float band);
+
+#define UNORM_FUNC_VARIANTS(suffix, target) \
+    target static void encode_unorm8_##suffix(const float* src, uint8_t* dst, int n, float band, int x, int y, bool dither) { encode_row<uint8_t, UNORM8_MAX>(src, dst, n, band, x, y, dither); } \
+    target static void encode_unorm16_##suffix(const float* src, uint16_t* dst, int n, float band, int x, int y, bool dither) { encode_row<uint16_t, UNORM16_MAX>(src, dst, n, band, x, y, dither); } \
+    target static void decode_unorm8_##suffix(const uint8_t* src, float* dst, int n, float band) { decode_row<uint8_t, UNORM8_MAX>(src, dst, n, band); } \
+    target static void decode_unorm16_##suffix(const uint16_t* src, float* dst, int n, float band) { decode_row<uint16_t, UNORM16_MAX>(src, dst, n, band); }
+
+UNORM_FUNC_VARIANTS(sse2, )
+UNORM_FUNC_VARIANTS(avx2, CPU_TARGET_AVX2)
+UNORM_FUNC_VARIANTS(avx512, CPU_TARGET_AVX512)
+
+static const EncodeUnorm8Func ENCODE_UNORM8_FUNCS[NumCPUPaths] = { encode_unorm8_sse2, encode_unorm8_avx2, encode_unorm8_avx512 };
+static const EncodeUnorm16Func ENCODE_UNORM16_FUNCS[NumCPUPaths] = { encode_unorm16_sse2, encode_unorm16_avx2, encode_unorm16_avx512 };
+static const DecodeUnorm8Func DECODE_UNORM8_FUNCS[NumCPUPaths] = { decode_unorm8_sse2, decode_unorm8_avx2, decode_unorm8_avx512 };
+static const DecodeUnorm16Func DECODE_UNORM16_FUNCS[NumCPUPaths] = { decode_unorm16_sse2, decode_unorm16_avx2, decode_unorm16_avx512 };
+
+void distance_to_unorm8_row(const float* src, uint8_t* dst, int n, float band, int x, int y, bool dither) {
+    ENCODE_UNORM8_FUNCS[GetCPUPath()](src, dst, n, band, x, y, dither);
+}
+
+void distance_to_unorm16_row(const float* src, uint16_t* dst, int n, float band, int x, int y, bool dither) {
+    ENCODE_UNORM16_FUNCS[GetCPUPath()](src, dst, n, band, x, y, dither);
+}
+
+void unorm8_to_distance_row(const uint8_t* src, float* dst, int n, float band) {
+    DECODE_UNORM8_FUNCS[GetCPUPath()](src, dst, n, band);
+}
+
+void unorm16_to_distance_row(const uint16_t* src, float* dst, int n, float band) {
+    DECODE_UNORM16_FUNCS[GetCPUPath()](src, dst, n, band);
+}
+
+void EncodingErrorStats::AccumulateRow(const float* reference, const float* decoded, int n, float band) {
+    // per row sums stay small enough for float, the totals are kept in double.
+    float rowMax = 0.0f;
+    float rowSum = 0.0f;
+    float rowSumSquared = 0.0f;
+    int rowCount = 0;
+    for (int i = 0; i < n; i++) {
+        if (fabsf(reference[i]) < band) {
+            float e = fabsf(decoded[i] - reference[i]);
+            rowMax = e > rowMax ? e : rowMax;
+            rowSum += e;
+            rowSumSquared += e * e;
+            rowCount++;
+        }
+    }
+    maxError = rowMax > maxError ? rowMax : maxError;
+    sumError += rowSum;
+    sumSquaredError += rowSumSquared;
+    count += rowCount;
+}
+
+float EncodingErrorStats::GetMeanError() const {
+    return count ? (float)(sumError / (double)count) : 0.0f;
+}
+
+float EncodingErrorStats::GetRMSError() const {
+    return count ? (float)sqrt(sumSquaredError / (double)count) : 0.0f;
+}
@@ -0,0 +1,53 @@
+//
+//  unorm.h
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_Unorm_h
+#define hifi_Unorm_h
+
+#include <stdint.h>
+
+// Narrow band distance encoding, [-band, band] maps linearly onto [0, 1] stored as
+// 8 or 16-bit normalized integers.  Distances past the band saturate, which is fine
+// for rendering since only the sign and the neighborhood of the edge are shaded.
+//
+// Without dithering the error inside the band is at most half a step, band / max.
+// Ordered dithering doubles the worst case to a full step but makes the error
+// average out over a 4x4 block, hiding the contour bands 8-bit encoding produces.
+
+static const uint32_t UNORM8_MAX = 0xff;
+static const uint32_t UNORM16_MAX = 0xffff;
+
+inline float unorm8_to_distance(uint8_t q, float band) {
+    return (float)q * (2.0f * band / (float)UNORM8_MAX) - band;
+}
+
+inline float unorm16_to_distance(uint16_t q, float band) {
+    return (float)q * (2.0f * band / (float)UNORM16_MAX) - band;
+}
+
+// encode n distances starting at buffer texel (x, y), the position picks the dither pattern.
+void distance_to_unorm8_row(const float* src, uint8_t* dst, int n, float band, int x, int y, bool dither);
+void distance_to_unorm16_row(const float* src, uint16_t* dst, int n, float band, int x, int y, bool dither);
+void unorm8_to_distance_row(const uint8_t* src, float* dst, int n, float band);
+void unorm16_to_distance_row(const uint16_t* src, float* dst, int n, float band);
+
+// error of an encoding against the float distances it was made from.
+// only texels the band covers are counted, everything else saturates on purpose.
+struct EncodingErrorStats {
+    EncodingErrorStats() : maxError(0.0f), sumError(0.0), sumSquaredError(0.0), count(0) {}
+
+    void AccumulateRow(const float* reference, const float* decoded, int n, float band);
+    float GetMeanError() const;
+    float GetRMSError() const;
+
+    float maxError;
+    double sumError;
+    double sumSquaredError;
+    uint64_t count;
+};
+
+#endif